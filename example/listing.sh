@@ -0,0 +1,7 @@
+#!/bin/sh
+# Convert each document named on the command line.
+for f in "$@"
+do
+  ./bin/tex2web -x "$f" -o "${f%.tex}.html" && echo "$f -> ${f%.tex}.html"
+done
+test $# -gt 0 || echo 'usage: listing.sh FILE.tex...' >&2
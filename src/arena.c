@@ -0,0 +1,121 @@
+/**
+ * Memory for temporaries that are all released at once.
+ **/
+
+#include "arena.h"
+
+#include <stdlib.h>
+
+/** Smallest block size.**/
+#define ArenaBlockSz  (16 * 1024)
+/** Alignment of every allocation.**/
+#define ArenaAlign  16
+
+struct ArenaBlock
+{
+  ArenaBlock* next;
+  zuint sz;
+};
+
+/** Offset of the first usable byte of a block.**/
+#define ArenaHeadSz \
+  ((sizeof (ArenaBlock) + ArenaAlign - 1) & ~(zuint) (ArenaAlign - 1))
+
+static
+  ArenaBlock*
+new_ArenaBlock (zuint n, ArenaBlock* next)
+{
+  ArenaBlock* block;
+  if (n < ArenaBlockSz)
+    n = ArenaBlockSz;
+  block = (ArenaBlock*) malloc (ArenaHeadSz + n);
+  block->next = next;
+  block->sz = n;
+  return block;
+}
+
+  void
+init_Arena (Arena* arena)
+{
+  arena->first = 0;
+  arena->cur = 0;
+  arena->off = 0;
+}
+
+  void
+lose_Arena (Arena* arena)
+{
+  ArenaBlock* block = arena->first;
+  while (block) {
+    ArenaBlock* next = block->next;
+    free (block);
+    block = next;
+  }
+  init_Arena (arena);
+}
+
+/** Release everything taken from {arena}, keeping its blocks.**/
+  void
+reset_Arena (Arena* arena)
+{
+  arena->cur = arena->first;
+  arena->off = 0;
+}
+
+  ArenaMark
+mark_Arena (const Arena* arena)
+{
+  ArenaMark mark;
+  mark.block = arena->cur;
+  mark.off = arena->off;
+  return mark;
+}
+
+/** Release everything taken from {arena} since {mark}.**/
+  void
+release_Arena (Arena* arena, ArenaMark mark)
+{
+  if (!mark.block) {
+    reset_Arena (arena);
+    return;
+  }
+  arena->cur = mark.block;
+  arena->off = mark.off;
+}
+
+/** Take {n} bytes that last until they are released.
+ * Blocks left over from earlier use are taken when they are big enough.
+ **/
+  void*
+take_Arena (Arena* arena, zuint n)
+{
+  byte* p;
+  n = (n + ArenaAlign - 1) & ~(zuint) (ArenaAlign - 1);
+  if (!arena->cur) {
+    if (!arena->first)
+      arena->first = new_ArenaBlock (n, 0);
+    arena->cur = arena->first;
+    arena->off = 0;
+  }
+  while (arena->cur->sz - arena->off < n) {
+    ArenaBlock* cur = arena->cur;
+    if (!cur->next || cur->next->sz < n) {
+      cur->next = new_ArenaBlock (n, cur->next);
+    }
+    arena->cur = cur->next;
+    arena->off = 0;
+  }
+  p = (byte*) arena->cur + ArenaHeadSz + arena->off;
+  arena->off += n;
+  return p;
+}
+
+/** Copy {n} bytes of {s} into {arena}, followed by a NUL.**/
+  char*
+dup_Arena (Arena* arena, const char* s, zuint n)
+{
+  char* p = (char*) take_Arena (arena, n + 1);
+  memcpy (p, s, n);
+  p[n] = '\0';
+  return p;
+}
@@ -0,0 +1,46 @@
+/**
+ * Memory for temporaries that are all released at once.
+ **/
+#ifndef ARENA_H_
+#define ARENA_H_
+#include "cx/ofile.h"
+
+typedef struct ArenaBlock ArenaBlock;
+
+/** Bump allocator over a list of blocks.
+ * Releasing keeps the blocks, so a reused arena stops calling malloc().
+ **/
+typedef struct Arena Arena;
+struct Arena
+{
+  ArenaBlock* first;
+  /** Block that allocations are taken from.**/
+  ArenaBlock* cur;
+  /** Bytes of {cur} in use.**/
+  zuint off;
+};
+
+/** A point to release an arena back to.**/
+typedef struct ArenaMark ArenaMark;
+struct ArenaMark
+{
+  ArenaBlock* block;
+  zuint off;
+};
+
+void
+init_Arena (Arena* arena);
+void
+lose_Arena (Arena* arena);
+void
+reset_Arena (Arena* arena);
+ArenaMark
+mark_Arena (const Arena* arena);
+void
+release_Arena (Arena* arena, ArenaMark mark);
+void*
+take_Arena (Arena* arena, zuint n);
+char*
+dup_Arena (Arena* arena, const char* s, zuint n);
+
+#endif
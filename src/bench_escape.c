@@ -0,0 +1,195 @@
+/**
+ * Measure the HTML escaping throughput on code-heavy text.
+ *
+ * Usage example:
+ *   bench_escape 64 20
+ * escapes 64 MB of generated C-like code 20 times
+ * and reports GB/s for text and attribute escaping.
+ * The text output is checked against the XFile search that
+ * escape_for_html() used before, and both against bytewise escaping.
+ **/
+
+#include "cx/syscx.h"
+#include "cx/ofile.h"
+#include "cx/xfile.h"
+#include "htmlesc.h"
+
+#include <time.h>
+
+/** Fill {s} with {n} bytes of source code, which is dense in <>&".**/
+static
+  void
+gen_code (char* s, zuint n)
+{
+  static const char* const lines[] = {
+    "  for (i = 0; i < n && a[i] > 0; ++i) {\n",
+    "    printf (\"%d -> %s\\n\", i, names[i]);\n",
+    "    if ((flags & Mask) != 0 || x->next == NULL)\n",
+    "      return a < b ? a : b;\n",
+    "  std::vector<std::pair<int, char>> v;\n",
+    "  /* Copy the plain text over with no changes at all. */\n",
+    "  x = y << 2 | (z >> 3) & 0xff;\n",
+    "  }\n",
+  };
+  zuint off = 0;
+  uint i = 0;
+  while (off < n) {
+    const char* line = lines[i++ % ArraySz(lines)];
+    zuint len = strlen (line);
+    if (len > n - off)
+      len = n - off;
+    memcpy (&s[off], line, len);
+    off += len;
+  }
+}
+
+/** Escape one byte at a time, to check the output and compare speed.**/
+static
+  void
+oput_escaped_bytewise (OFile* of, const char* s, zuint n, HtmlEscMode mode)
+{
+  for (zuint i = 0; i < n; ++i) {
+    const char* e = entity_html (s[i], mode);
+    if (e)
+      oput_cstr_OFile (of, e);
+    else
+      oput_char_OFile (of, s[i]);
+  }
+}
+
+/** Escape like escape_for_html() did before the table-driven kernel,
+ * by searching an XFile for delimiters, to check the text output.
+ * Attributes were escaped the same way, but now also escape single quotes.
+ **/
+static
+  void
+oput_escaped_xfile (OFile* of, const char* s, zuint n, HtmlEscMode mode)
+{
+  const char delims[] = "\\\"&<>";
+  AlphaTab ab = dflt_AlphaTab ();
+  XFile xf[1];
+  char* t;
+  char match = 0;
+  (void) mode;
+  ab.s = AllocT( char, n+1 );
+  ab.sz = n+1;
+  memcpy (ab.s, s, n);
+  ab.s[n] = '\0';
+  init_XFile_olay_AlphaTab (xf, &ab);
+  while ((t = nextds_XFile (xf, &match, delims)))
+  {
+    oput_cstr_OFile (of, t);
+    putlast_char_XFile (xf, match);
+
+    switch (match)
+    {
+    case '"':
+      oput_cstr_OFile (of, "&quot;");
+      break;
+    case '&':
+      oput_cstr_OFile (of, "&amp;");
+      break;
+    case '<':
+      oput_cstr_OFile (of, "&lt;");
+      break;
+    case '>':
+      oput_cstr_OFile (of, "&gt;");
+      break;
+    case '\\':
+      oput_char_OFile (of, '\\');
+      break;
+    default:
+      break;
+    }
+  }
+  free (ab.s);
+}
+
+static
+  double
+now_sec ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+typedef void (*EscapeFn) (OFile*, const char*, zuint, HtmlEscMode);
+
+static
+  double
+time_escape (EscapeFn fn, const char* s, zuint n, HtmlEscMode mode,
+             uint rounds, AlphaTab* ret)
+{
+  double best = 0;
+  for (uint r = 0; r < rounds; ++r) {
+    OFile of[] = default;
+    double t = now_sec ();
+    fn (of, s, n, mode);
+    t = now_sec () - t;
+    if (r == 0 || t < best)
+      best = t;
+    if (r == 0 && ret)
+      init_AlphaTab_move_OFile (ret, of);
+    lose_OFile (of);
+  }
+  return best;
+}
+
+  int
+main (int argc, char** argv)
+{
+  int argi =
+    (init_sysCx (&argc, &argv),
+     1);
+  OFile* of = stdout_OFile ();
+  zuint mb = 16;
+  uint rounds = 10;
+  char* s;
+  zuint n;
+  bool good = true;
+
+  if (argi < argc)
+    mb = (zuint) atoi (argv[argi++]);
+  if (argi < argc)
+    rounds = (uint) atoi (argv[argi++]);
+  if (mb == 0 || rounds == 0)
+    failout_sysCx ("usage: bench_escape [MB] [ROUNDS]");
+
+  n = mb << 20;
+  s = AllocT( char, n );
+  gen_code (s, n);
+
+  for (uint m = 0; m < 2; ++m) {
+    const HtmlEscMode mode = (m == 0 ? HtmlEscText : HtmlEscAttr);
+    AlphaTab fast = default;
+    AlphaTab slow = default;
+    const double t_fast =
+      time_escape (oput_escaped_html, s, n, mode, rounds, &fast);
+    const double t_slow =
+      time_escape (oput_escaped_bytewise, s, n, mode, rounds, &slow);
+    if (fast.sz != slow.sz || 0 != memcmp (fast.s, slow.s, fast.sz)) {
+      good = false;
+      printf_OFile (of, "%s: output differs from bytewise escaping\n",
+                    m == 0 ? "text" : "attr");
+    }
+    if (mode == HtmlEscText) {
+      AlphaTab orig = default;
+      time_escape (oput_escaped_xfile, s, n, mode, 1, &orig);
+      if (fast.sz != orig.sz || 0 != memcmp (fast.s, orig.s, fast.sz)) {
+        good = false;
+        printf_OFile (of, "text: output differs from escape_for_html()\n");
+      }
+      lose_AlphaTab (&orig);
+    }
+    printf_OFile (of, "%s: %.2f GB/s (bytewise %.2f GB/s)\n",
+                  m == 0 ? "text" : "attr",
+                  n / t_fast / 1e9, n / t_slow / 1e9);
+    lose_AlphaTab (&fast);
+    lose_AlphaTab (&slow);
+  }
+
+  free (s);
+  lose_sysCx ();
+  return good ? 0 : 1;
+}
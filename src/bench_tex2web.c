@@ -0,0 +1,699 @@
+/**
+ * Measure tex2web on generated documents and report JSON.
+ *
+ * Usage example:
+ *   bench_tex2web -max 64M -rounds 5 > bench.json
+ *   bench_tex2web -max 1G -corpus corpus
+ * converts prose-heavy, macro-heavy, table-heavy, code-heavy and deeply
+ * nested documents of just under 10K, 100K, 1M, ... bytes up to -max,
+ * and times the escaping, macro lookup, command dispatch, tabular and
+ * output assembly paths on their own.
+ * Each result gives MB/s of input, allocations per MB and peak RSS,
+ * except that foot_html is measured by the bytes of HTML it writes.
+ * The peak is reset before each benchmark through /proc/self/clear_refs,
+ * and "rss_reset" is false when that could not be done,
+ * in which case the peak covers the whole run so far.
+ * With -corpus, the documents are also written to that directory
+ * so the tex2web binary can be run on them.
+ *
+ * The documents only depend on their kind and size,
+ * so runs of different builds are comparable.
+ **/
+
+/* As tex2web.c needs, since this comes first.*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+
+#if defined(__GLIBC__)
+/** Allocator calls made by this thread.
+ * The allocator is wrapped to count them,
+ * which only this benchmark does.
+ **/
+static __thread size_t thread_nallocs = 0;
+
+extern void* __libc_malloc (size_t n);
+extern void* __libc_calloc (size_t n, size_t sz);
+extern void* __libc_realloc (void* p, size_t n);
+
+  void*
+malloc (size_t n)
+{
+  thread_nallocs += 1;
+  return __libc_malloc (n);
+}
+
+  void*
+calloc (size_t n, size_t sz)
+{
+  thread_nallocs += 1;
+  return __libc_calloc (n, sz);
+}
+
+  void*
+realloc (void* p, size_t n)
+{
+  thread_nallocs += 1;
+  return __libc_realloc (p, n);
+}
+#define Tex2WebCountAllocs 1
+#endif
+
+/* Take tex2web whole so that its static functions can be timed.
+ * Its -stats support is kept for the allocation count.
+ */
+#undef Tex2WebStats
+#define Tex2WebStats 1
+#define main main_tex2web
+#include "tex2web.c"
+#undef main
+
+#include <sys/resource.h>
+
+typedef enum CorpusKind CorpusKind;
+enum CorpusKind
+{
+  CorpusProse,
+  CorpusMacro,
+  CorpusTable,
+  CorpusCode,
+  CorpusNested,
+  NCorpusKinds
+};
+
+static const char* const corpus_names[NCorpusKinds] = {
+  "prose", "macro", "table", "code", "nested"
+};
+
+/** Number of macros that macro-heavy text uses.**/
+#define NBenchMacros 64
+/** Pieces in a row that may be dropped for not fitting
+ * before a document is taken as full.
+ **/
+#define MaxBenchMisses 64
+
+/** Deterministic text generator.**/
+typedef struct Gen Gen;
+struct Gen
+{
+  OFile* of;
+  uint32_t seed;
+  uint nparagraphs;
+};
+
+static
+  uint
+rand_Gen (Gen* g, uint n)
+{
+  g->seed = g->seed * 1103515245u + 12345u;
+  return (g->seed >> 8) % n;
+}
+
+static
+  void
+word_Gen (Gen* g)
+{
+  static const char* const words[] = {
+    "the", "conversion", "of", "simple", "documents", "into", "pages",
+    "is", "a", "matter", "for", "text", "with", "very", "few", "commands",
+    "where", "each", "paragraph", "reads", "plainly", "and", "quickly",
+  };
+  oput_cstr_OFile (g->of, words[rand_Gen (g, ArraySz(words))]);
+}
+
+static
+  void
+line_of_code_Gen (Gen* g)
+{
+  static const char* const lines[] = {
+    "  for (i = 0; i < n && a[i] > 0; ++i) {\n",
+    "    printf (\"%d -> %s\\n\", i, names[i]);\n",
+    "    if ((flags & Mask) != 0 || x->next == NULL)\n",
+    "      return a < b ? a : b;\n",
+    "  std::vector<std::pair<int, char>> v;\n",
+    "  x = y << 2 | (z >> 3) & 0xff;\n",
+    "  }\n",
+  };
+  oput_cstr_OFile (g->of, lines[rand_Gen (g, ArraySz(lines))]);
+}
+
+/** Name of the {i}th macro, which is letters only.**/
+static
+  void
+macro_name (char* name, uint i)
+{
+  name[0] = 'm';
+  name[1] = 'a';
+  name[2] = (char) ('a' + i / 26 % 26);
+  name[3] = (char) ('a' + i % 26);
+  name[4] = '\0';
+}
+
+static
+  void
+sentence_Gen (Gen* g, CorpusKind kind)
+{
+  const uint n = 6 + rand_Gen (g, 12);
+  for (i ; n) {
+    const uint r = rand_Gen (g, 24);
+    if (i > 0)
+      oput_char_OFile (g->of, ' ');
+    if (kind == CorpusMacro && r < 6) {
+      char name[5];
+      macro_name (name, rand_Gen (g, NBenchMacros));
+      oput_char_OFile (g->of, '\\');
+      oput_cstr_OFile (g->of, name);
+    }
+    else if (kind == CorpusMacro && r == 6) {
+      oput_cstr_OFile (g->of, "\\pair{");
+      word_Gen (g);
+      oput_cstr_OFile (g->of, "}{");
+      word_Gen (g);
+      oput_char_OFile (g->of, '}');
+    }
+    else if (r == 7) {
+      oput_cstr_OFile (g->of, "\\textbf{");
+      word_Gen (g);
+      oput_char_OFile (g->of, '}');
+    }
+    else if (r == 8) {
+      oput_cstr_OFile (g->of, "\\textit{");
+      word_Gen (g);
+      oput_char_OFile (g->of, '}');
+    }
+    else if (r == 9) {
+      oput_cstr_OFile (g->of, "\\ilcode{a < b && c}");
+    }
+    else {
+      word_Gen (g);
+    }
+  }
+  oput_char_OFile (g->of, '.');
+}
+
+static
+  void
+paragraph_Gen (Gen* g, CorpusKind kind)
+{
+  const uint n = 2 + rand_Gen (g, 5);
+  if (g->nparagraphs % 40 == 0) {
+    oput_cstr_OFile (g->of, "\\section{");
+    word_Gen (g);
+    oput_char_OFile (g->of, ' ');
+    word_Gen (g);
+    oput_cstr_OFile (g->of, "}\n\n");
+  }
+  g->nparagraphs += 1;
+  for (i ; n) {
+    sentence_Gen (g, kind);
+    oput_char_OFile (g->of, '\n');
+  }
+  oput_char_OFile (g->of, '\n');
+}
+
+static
+  void
+tabular_Gen (Gen* g)
+{
+  const uint nrows = 8 + rand_Gen (g, 24);
+  oput_cstr_OFile (g->of, "\\begin{tabular}{|l|cr|l|}\n");
+  for (uint row = 0; row < nrows; ++row) {
+    if (row > 0)
+      oput_cstr_OFile (g->of, (row == 1 ? "\\\\ \\hline\n" : "\\\\ "));
+    for (uint col = 0; col < 4; ++col) {
+      if (col > 0)
+        oput_cstr_OFile (g->of, " & ");
+      if (row == 0)
+        oput_cstr_OFile (g->of, "\\textbf{");
+      word_Gen (g);
+      if (row == 0)
+        oput_char_OFile (g->of, '}');
+    }
+    oput_char_OFile (g->of, '\n');
+  }
+  oput_cstr_OFile (g->of, "\\end{tabular}\n\n");
+}
+
+static
+  void
+code_Gen (Gen* g)
+{
+  const uint n = 10 + rand_Gen (g, 30);
+  sentence_Gen (g, CorpusCode);
+  oput_cstr_OFile (g->of, "\n\\begin{code}\n");
+  for (i ; n)
+    line_of_code_Gen (g);
+  oput_cstr_OFile (g->of, "\\end{code}\n\n");
+}
+
+static
+  void
+nested_Gen (Gen* g, uint depth)
+{
+  const uint n = 2 + rand_Gen (g, 3);
+  oput_cstr_OFile (g->of, "\\begin{itemize}\n");
+  for (i ; n) {
+    oput_cstr_OFile (g->of, "\\item \\textbf{");
+    word_Gen (g);
+    oput_cstr_OFile (g->of, " \\textit{");
+    word_Gen (g);
+    oput_cstr_OFile (g->of, " \\underline{");
+    word_Gen (g);
+    oput_cstr_OFile (g->of, "}}} ");
+    sentence_Gen (g, CorpusNested);
+    oput_char_OFile (g->of, '\n');
+    if (depth < 6 && rand_Gen (g, 2) == 0)
+      nested_Gen (g, depth + 1);
+  }
+  oput_cstr_OFile (g->of, "\\end{itemize}\n");
+}
+
+/** Write a whole document of the given {kind} with at most {sz} bytes.
+ * Pieces that would take it past {sz} are dropped,
+ * so it stops a little short of that size.
+ **/
+static
+  void
+gen_document (OFile* of, CorpusKind kind, zuint sz)
+{
+  static const char end_cstr[] = "\n\\end{document}\n";
+  Gen g[1];
+  uint nmisses = 0;
+  g->of = of;
+  g->seed = 1 + (uint32_t) kind;
+  g->nparagraphs = 0;
+
+  oput_cstr_OFile (of, "\\title{Benchmark: ");
+  oput_cstr_OFile (of, corpus_names[kind]);
+  oput_cstr_OFile (of, "}\n\\date{}\n\n");
+  if (kind == CorpusMacro) {
+    for (i ; NBenchMacros) {
+      char name[5];
+      macro_name (name, i);
+      printf_OFile (of, "\\newcommand{\\%s}{value %lu & more}\n",
+                    name, (unsigned long) i);
+    }
+    oput_cstr_OFile (of, "\\newcommand{\\pair}[2]{(#1, #2)}\n");
+  }
+  oput_cstr_OFile (of, "\n\\begin{document}\n\n");
+
+  while (nmisses < MaxBenchMisses) {
+    const zuint off = of->off;
+    switch (kind)
+    {
+    case CorpusProse:
+    case CorpusMacro:
+      paragraph_Gen (g, kind);
+      break;
+    case CorpusTable:
+      tabular_Gen (g);
+      break;
+    case CorpusCode:
+      code_Gen (g);
+      break;
+    case CorpusNested:
+      nested_Gen (g, 0);
+      oput_char_OFile (of, '\n');
+      break;
+    case NCorpusKinds:
+      break;
+    }
+    if (of->off + strlen (end_cstr) > sz) {
+      of->off = off;
+      nmisses += 1;
+    }
+    else {
+      nmisses = 0;
+    }
+  }
+  oput_cstr_OFile (of, end_cstr);
+}
+
+/** Write just the body text for one of the microbenchmarks.**/
+static
+  void
+gen_fragment (OFile* of, const char* name, zuint sz)
+{
+  Gen g[1];
+  g->of = of;
+  g->seed = 7;
+  g->nparagraphs = 1;
+  while (of->off < sz) {
+    if (eq_cstr ("escape", name)) {
+      line_of_code_Gen (g);
+    }
+    else if (eq_cstr ("macro_lookup", name)) {
+      /* Only macros and words, since other commands are not handled.*/
+      if (rand_Gen (g, 4) == 0) {
+        char macro[5];
+        macro_name (macro, rand_Gen (g, NBenchMacros));
+        oput_char_OFile (of, '\\');
+        oput_cstr_OFile (of, macro);
+      }
+      else {
+        word_Gen (g);
+      }
+      oput_char_OFile (of, ' ');
+    }
+    else if (eq_cstr ("dispatch", name)) {
+      oput_cstr_OFile (of, "\\textbf{a} \\textit{b} \\texttt{c} \\ilkey{d}"
+                       " \\ilfile{e} \\underline{f} \\ilcode{g}\n");
+    }
+    else {
+      tabular_Gen (g);
+    }
+  }
+}
+
+/** Start measuring peak RSS anew, if the kernel allows it.**/
+static
+  bool
+reset_peak_rss ()
+{
+  int fd = open ("/proc/self/clear_refs", O_WRONLY);
+  bool good;
+  if (fd < 0)
+    return false;
+  good = (1 == write (fd, "5", 1));
+  return (0 == close (fd)) && good;
+}
+
+/** Peak RSS since reset_peak_rss(), or since the process started.**/
+static
+  unsigned long
+peak_rss_kb ()
+{
+  struct rusage ru;
+  unsigned long kb = 0;
+  FILE* f = fopen ("/proc/self/status", "r");
+  if (f) {
+    char line[256];
+    while (fgets (line, sizeof (line), f)) {
+      if (1 == sscanf (line, "VmHWM: %lu kB", &kb))
+        break;
+    }
+    fclose (f);
+  }
+  if (kb > 0)
+    return kb;
+  getrusage (RUSAGE_SELF, &ru);
+  return (unsigned long) ru.ru_maxrss;
+}
+
+/** Text to convert, copied again before each round
+ * since conversion writes into its input.
+ **/
+typedef struct BenchText BenchText;
+struct BenchText
+{
+  const char* text;
+  zuint sz;
+  char* work;
+  XFile xf[1];
+};
+
+static
+  void
+init_BenchText (BenchText* b, OFile* of)
+{
+  b->sz = of->off;
+  b->text = window2_OFile (of, 0, of->off).s;
+  b->work = AllocT( char, b->sz + 1 );
+}
+
+static
+  XFile*
+fresh_BenchText (BenchText* b)
+{
+  AlphaTab ab = dflt_AlphaTab ();
+  memcpy (b->work, b->text, b->sz);
+  b->work[b->sz] = '\0';
+  ab.s = b->work;
+  ab.sz = b->sz + 1;
+  init_XFile_olay_AlphaTab (b->xf, &ab);
+  return b->xf;
+}
+
+/** What a benchmark does in one round.**/
+typedef enum BenchOp BenchOp;
+enum BenchOp
+{
+  BenchDocument,
+  BenchEscape,
+  BenchMacroLookup,
+  BenchBody,
+  BenchFoot
+};
+
+/** Set up {st} for a round of {op} on {b}, outside of the timing.**/
+static
+  void
+setup_BenchOp (BenchOp op, BenchText* b, HtmlState* st)
+{
+  if (op == BenchFoot) {
+    /* Assemble the input as a body split around a table of contents.*/
+    oputn_char_OFile (st->body_ofile, b->text, b->sz);
+    oputn_char_OFile (st->toc_ofile, b->text, b->sz / 16);
+    st->toc_pos = b->sz / 2;
+    st->show_toc = true;
+  }
+}
+
+/** Run {op} once on the text {xf} with the state {st}.**/
+static
+  bool
+run_BenchOp (BenchOp op, XFile* xf, HtmlState* st, OSink* sink)
+{
+  bool good = true;
+  switch (op)
+  {
+  case BenchDocument:
+    good = htdocument (st, xf);
+    break;
+  case BenchEscape:
+    escape_for_html (st->body_ofile, xf, 0);
+    break;
+  case BenchMacroLookup:
+    escape_for_html (st->body_ofile, xf, st);
+    good = st->allgood;
+    break;
+  case BenchBody:
+    {
+      TexIndex idx[1];
+      init_TexIndex (idx);
+      build_TexIndex (idx, cstr_of_XFile (xf));
+      st->index = idx;
+      good = htbody (st->body_ofile, xf, st);
+      st->index = 0;
+      lose_TexIndex (idx);
+    }
+    break;
+  case BenchFoot:
+    foot_html (st);
+    good = sink->good;
+    break;
+  }
+  return good;
+}
+
+/** Time {rounds} runs of {op} and write the best as a JSON object.**/
+static
+  bool
+bench (OFile* json, bool* first, const char* name, BenchOp op,
+       OFile* text, HtmlState* proto, uint rounds)
+{
+  BenchText b[1];
+  HtmlState st[1];
+  OSink sink[1];
+  OFile out[] = default;
+  zuint sz;
+  double best = 0;
+  zuint allocs = 0;
+  bool good = true;
+  bool rss_reset;
+
+  init_BenchText (b, text);
+  rss_reset = reset_peak_rss ();
+  init_count_OSink (sink);
+  init_HtmlState (st, sink);
+
+  for (uint r = 0; r < rounds; ++r) {
+    XFile* xf = fresh_BenchText (b);
+    zuint nallocs_beg;
+    double t;
+    /* Only the assembled HTML is kept, as writing it is what is timed.*/
+    out->off = 0;
+    if (op == BenchFoot)
+      init_mem_OSink (sink, out);
+    else
+      init_count_OSink (sink);
+    reset_HtmlState (st, proto, sink);
+    st->errfile = stderr_OFile ();
+    setup_BenchOp (op, b, st);
+    nallocs_beg = thread_nallocs;
+    t = now_sec ();
+    good = run_BenchOp (op, xf, st, sink) && good;
+    t = now_sec () - t;
+    if (r == 0 || t < best)
+      best = t;
+    if (r == 0)
+      allocs = thread_nallocs - nallocs_beg;
+  }
+
+  sz = (op == BenchFoot ? sink->nbytes : b->sz);
+  {
+    const double mb = sz / 1e6;
+    printf_OFile (json, "%s\n    {\"name\": \"%s\", \"bytes\": %lu,"
+                  " \"seconds\": %.6f, \"mb_per_s\": %.2f,"
+                  " \"allocs_per_mb\": %.1f, \"peak_rss_kb\": %lu,"
+                  " \"rss_reset\": %s, \"ok\": %s}",
+                  (*first ? "" : ","), name, (unsigned long) sz,
+                  best, (best > 0 ? mb / best : 0), allocs / mb,
+                  peak_rss_kb (), (rss_reset ? "true" : "false"),
+                  (good ? "true" : "false"));
+    *first = false;
+  }
+
+  lose_HtmlState (st);
+  lose_OFile (out);
+  free (b->work);
+  return good;
+}
+
+/** Parse a size like 10K, 64M or 1G.**/
+static
+  zuint
+parse_size (const char* s)
+{
+  char* end = 0;
+  zuint n = (zuint) strtoul (s, &end, 10);
+  switch (end ? *end : '\0')
+  {
+  case 'K': case 'k': return n << 10;
+  case 'M': case 'm': return n << 20;
+  case 'G': case 'g': return n << 30;
+  default: return n;
+  }
+}
+
+/** Write {of} to {dir}/{name}.tex for use outside the benchmark.**/
+static
+  bool
+save_corpus (const char* dir, const char* name, OFile* of)
+{
+  AlphaTab filename = dflt_AlphaTab ();
+  OSink sink[1];
+  struct iovec segs[1];
+  int fd;
+  cat_cstr_AlphaTab (&filename, name);
+  cat_cstr_AlphaTab (&filename, ".tex");
+  fd = open_output_fd (dir, ccstr_of_AlphaTab (&filename));
+  lose_AlphaTab (&filename);
+  if (fd < 0)
+    return false;
+  init_fd_OSink (sink, fd);
+  segs[0].iov_base = window2_OFile (of, 0, of->off).s;
+  segs[0].iov_len = of->off;
+  writev_OSink (sink, segs, 1);
+  return (0 == close (fd)) && sink->good;
+}
+
+  int
+main (int argc, char** argv)
+{
+  static const char* const micro_names[] = {
+    "escape", "macro_lookup", "dispatch", "tabular", "foot_html"
+  };
+  static const BenchOp micro_ops[] = {
+    BenchEscape, BenchMacroLookup, BenchBody, BenchBody, BenchFoot
+  };
+  static const char* const size_names[] = {
+    "10K", "100K", "1M", "10M", "100M", "1G"
+  };
+  int argi =
+    (init_sysCx (&argc, &argv),
+     1);
+  OFile* json = stdout_OFile ();
+  zuint max_sz = 16 << 20;
+  uint rounds = 5;
+  const char* corpus_dir = 0;
+  bool first = true;
+  bool good = true;
+  HtmlState proto[1];
+
+  while (argi < argc) {
+    const char* arg = argv[argi++];
+    if (argi == argc)
+      failout_sysCx ("usage: bench_tex2web [-max SIZE] [-rounds N]"
+                     " [-corpus DIR]");
+    if (eq_cstr ("-max", arg))
+      max_sz = parse_size (argv[argi++]);
+    else if (eq_cstr ("-rounds", arg))
+      rounds = (uint) atoi (argv[argi++]);
+    else if (eq_cstr ("-corpus", arg))
+      corpus_dir = argv[argi++];
+    else
+      failout_sysCx ("unknown option");
+  }
+  if (max_sz == 0 || rounds == 0)
+    failout_sysCx ("-max and -rounds must be positive");
+  if (corpus_dir && 0 != mkdir (corpus_dir, 0777) && errno != EEXIST)
+    failout_sysCx ("cannot create -corpus directory");
+
+  init_HtmlState (proto, 0);
+  for (i ; NBenchMacros) {
+    char name[5];
+    char value[32];
+    macro_name (name, i);
+    snprintf (value, sizeof (value), "value %lu and more", (unsigned long) i);
+    add_newcommand (proto, name, 0, value);
+  }
+  add_newcommand (proto, "pair", 2, "(#1, #2)");
+
+  printf_OFile (json, "{\"benchmarks\": [");
+
+  for (i ; ArraySz(micro_names)) {
+    OFile text[] = default;
+    const zuint sz = (max_sz < (16 << 20) ? max_sz : (16 << 20));
+    AlphaTab name = dflt_AlphaTab ();
+    gen_fragment (text, micro_names[i], sz);
+    cat_cstr_AlphaTab (&name, "micro/");
+    cat_cstr_AlphaTab (&name, micro_names[i]);
+    good = bench (json, &first, ccstr_of_AlphaTab (&name), micro_ops[i],
+                  text, proto, rounds) && good;
+    lose_AlphaTab (&name);
+    lose_OFile (text);
+  }
+
+  for (i ; ArraySz(size_names)) {
+    const zuint sz = parse_size (size_names[i]);
+    if (sz > max_sz)
+      break;
+    for (uint kind = 0; kind < NCorpusKinds; ++kind) {
+      OFile text[] = default;
+      AlphaTab name = dflt_AlphaTab ();
+      AlphaTab full = dflt_AlphaTab ();
+      gen_document (text, (CorpusKind) kind, sz);
+      cat_cstr_AlphaTab (&name, corpus_names[kind]);
+      cat_char_AlphaTab (&name, '-');
+      cat_cstr_AlphaTab (&name, size_names[i]);
+      if (corpus_dir &&
+          !save_corpus (corpus_dir, ccstr_of_AlphaTab (&name), text))
+        failout_sysCx ("cannot write to -corpus directory");
+      cat_cstr_AlphaTab (&full, "document/");
+      cat_cstr_AlphaTab (&full, ccstr_of_AlphaTab (&name));
+      good = bench (json, &first, ccstr_of_AlphaTab (&full),
+                    BenchDocument, text, proto, rounds) && good;
+      lose_AlphaTab (&full);
+      lose_AlphaTab (&name);
+      lose_OFile (text);
+    }
+  }
+
+  printf_OFile (json, "\n]}\n");
+  lose_HtmlState (proto);
+  lose_sysCx ();
+  return good ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+/**
+ * HTML escaping with a vectorized scan for characters that need it.
+ **/
+
+#include "htmlesc.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+enum {
+  HtmlEscTextBit = 1 << HtmlEscText,
+  HtmlEscAttrBit = 1 << HtmlEscAttr,
+  /** Backslash, which starts a macro.**/
+  HtmlEscMacroBit = 4
+};
+
+/** Which modes each byte must be escaped in.
+ * Single quotes are only special in attributes,
+ * where they may close the value.
+ **/
+static const byte html_esc_classes[256] = {
+  ['"'] = HtmlEscTextBit | HtmlEscAttrBit,
+  ['\''] = HtmlEscAttrBit,
+  ['&'] = HtmlEscTextBit | HtmlEscAttrBit,
+  ['<'] = HtmlEscTextBit | HtmlEscAttrBit,
+  ['>'] = HtmlEscTextBit | HtmlEscAttrBit,
+  ['\\'] = HtmlEscMacroBit
+};
+
+#if defined(__AVX2__) || defined(__SSE2__)
+/** Positions in a block of bytes that might need escaping in some mode.**/
+static inline
+  uint
+candidates_html (const char* s)
+{
+#if defined(__AVX2__)
+  const __m256i v = _mm256_loadu_si256 ((const __m256i*) s);
+  __m256i m = _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('"'));
+  m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\'')));
+  m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('&')));
+  m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('<')));
+  m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('>')));
+  m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\\')));
+  return (uint) _mm256_movemask_epi8 (m);
+#else
+  const __m128i v = _mm_loadu_si128 ((const __m128i*) s);
+  __m128i m = _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('"'));
+  m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\'')));
+  m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('&')));
+  m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('<')));
+  m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('>')));
+  m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\\')));
+  return (uint) _mm_movemask_epi8 (m);
+#endif
+}
+#endif
+
+/** Length of the prefix of the {n} bytes at {s} that can be written as is.
+ * With {macros}, a backslash also ends the prefix.
+ **/
+  zuint
+plain_span_html (const char* s, zuint n, HtmlEscMode mode, bool macros)
+{
+  const byte mask = (byte)
+    ((1 << mode) | (macros ? HtmlEscMacroBit : 0));
+  zuint i = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+#if defined(__AVX2__)
+  const zuint width = 32;
+#else
+  const zuint width = 16;
+#endif
+  for (; i + width <= n; i += width) {
+    uint bits = candidates_html (&s[i]);
+    /* Candidates that do not matter in this mode are rare,
+     * so they are skipped one at a time.
+     */
+    while (bits) {
+      const zuint j = i + (zuint) __builtin_ctz (bits);
+      if (html_esc_classes[(byte) s[j]] & mask)
+        return j;
+      bits &= bits - 1;
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    if (html_esc_classes[(byte) s[i]] & mask)
+      return i;
+  }
+  return n;
+}
+
+/** The entity that replaces {c}, or null if {c} needs no escaping.**/
+  const char*
+entity_html (char c, HtmlEscMode mode)
+{
+  if (!(html_esc_classes[(byte) c] & (1 << mode)))
+    return 0;
+  switch (c)
+  {
+  case '"':  return "&quot;";
+  case '\'': return "&#39;";
+  case '&':  return "&amp;";
+  case '<':  return "&lt;";
+  case '>':  return "&gt;";
+  }
+  return 0;
+}
+
+/** Write the {n} bytes at {s} to {of} with HTML escaping.
+ * Runs that need no escaping are copied as whole blocks.
+ **/
+  void
+oput_escaped_html (OFile* of, const char* s, zuint n, HtmlEscMode mode)
+{
+  while (n > 0) {
+    const zuint k = plain_span_html (s, n, mode, false);
+    if (k > 0)
+      oputn_char_OFile (of, s, k);
+    if (k == n)
+      break;
+    oput_cstr_OFile (of, entity_html (s[k], mode));
+    s = &s[k+1];
+    n -= k+1;
+  }
+}
@@ -0,0 +1,25 @@
+/**
+ * HTML escaping.
+ **/
+#ifndef HTMLESC_H_
+#define HTMLESC_H_
+#include "cx/ofile.h"
+
+/** Where escaped text ends up in the HTML.**/
+typedef enum HtmlEscMode HtmlEscMode;
+enum HtmlEscMode
+{
+  /** Between tags.**/
+  HtmlEscText,
+  /** In a quoted attribute value such as href="..." or src='...'.**/
+  HtmlEscAttr
+};
+
+zuint
+plain_span_html (const char* s, zuint n, HtmlEscMode mode, bool macros);
+const char*
+entity_html (char c, HtmlEscMode mode);
+void
+oput_escaped_html (OFile* of, const char* s, zuint n, HtmlEscMode mode);
+
+#endif
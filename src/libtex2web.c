@@ -0,0 +1,201 @@
+/**
+ * The converter of tex2web as a library, declared in tex2web.h.
+ *
+ * Each conversion sets up its own HtmlState from the options
+ * in the same way that -batch workers do, so the options are only read.
+ * A Tex2WebStream keeps such a state for as long as its document arrives.
+ **/
+
+/* Take tex2web whole, leaving out its main() and -stats.*/
+#undef Tex2WebStats
+#define Tex2WebStats 0
+#define main main_tex2web
+#include "tex2web.c"
+#undef main
+
+struct Tex2Web
+{
+  /** Options, which every conversion copies.**/
+  HtmlState proto[1];
+};
+
+  Tex2Web*
+new_Tex2Web ()
+{
+  Tex2Web* t = AllocT( Tex2Web, 1 );
+  init_HtmlState (t->proto, 0);
+  return t;
+}
+
+  void
+free_Tex2Web (Tex2Web* t)
+{
+  if (!t)  return;
+  lose_HtmlState (t->proto);
+  free (t);
+}
+
+/** Define the macro \{name} like -def does.**/
+  void
+def_Tex2Web (Tex2Web* t, const char* name, const char* value)
+{
+  add_newcommand (t->proto, name, 0, value);
+}
+
+  void
+css_Tex2Web (Tex2Web* t, const char* path)
+{
+  copy_cstr_AlphaTab (&t->proto->css_filepath, path);
+}
+
+/** Look for \input files in {dir} like -I does.**/
+  void
+search_path_Tex2Web (Tex2Web* t, const char* dir)
+{
+  *Grow1Table( t->proto->search_paths ) = cons1_AlphaTab (dir);
+}
+
+/** Take \input and \codeinputlisting files from {fn} alone.
+ * The file system is not read for them, so search paths are not used.
+ **/
+  void
+include_Tex2Web (Tex2Web* t, Tex2WebIncludeFn fn, void* arg)
+{
+  t->proto->include = fn;
+  t->proto->include_arg = arg;
+}
+
+/** Set up {st} to convert a document with the options of {t}.**/
+static
+  void
+init_state_Tex2Web (HtmlState* st, const Tex2Web* t, OSink* sink,
+                    OFile* log)
+{
+  HtmlState* proto = (HtmlState*) t->proto;
+  init_worker_HtmlState (st, proto);
+  reset_HtmlState (st, proto, sink);
+  st->errfile = log;
+}
+
+/** Give the problems in {log} to {*ret_log}, or null when there were none.**/
+static
+  void
+take_log_Tex2Web (OFile* log, char** ret_log)
+{
+  AlphaTab ab = dflt_AlphaTab ();
+  if (ret_log && log->off > 0) {
+    init_AlphaTab_move_OFile (&ab, log);
+    *ret_log = ab.s;
+  }
+  else {
+    if (ret_log)
+      *ret_log = 0;
+    lose_OFile (log);
+  }
+}
+
+/** Convert the {sz} bytes of {text} to an HTML document.
+ * The HTML is given in {*ret_html}, which the caller frees with free().
+ * When {ret_log} is not null, it gets the problems that were found
+ * as text that is also freed with free(), or null when there were none.
+ * Return nonzero when the document converted without problems.
+ **/
+  int
+convert_Tex2Web (const Tex2Web* t, const char* text, size_t sz,
+                 char** ret_html, size_t* ret_html_sz, char** ret_log)
+{
+  HtmlState st[1];
+  OFile html[] = default;
+  OFile log[] = default;
+  OSink sink[1];
+  AlphaTab ab = dflt_AlphaTab ();
+  XFile xf[1];
+  bool good;
+
+  init_mem_OSink (sink, html);
+  init_state_Tex2Web (st, t, sink, log);
+
+  /* Parsing writes into the text, so it works on a copy.*/
+  ab.s = AllocT( char, sz + 1 );
+  ab.sz = sz + 1;
+  memcpy (ab.s, text, sz);
+  ab.s[sz] = '\0';
+  init_XFile_olay_AlphaTab (xf, &ab);
+
+  good = htdocument (st, xf);
+  if (!good && st->nbogs == 0)
+    oput_cstr_OFile (log, "Failed to convert.\n");
+
+  free (ab.s);
+  lose_HtmlState (st);
+
+  *ret_html_sz = html->off;
+  init_AlphaTab_move_OFile (&ab, html);
+  *ret_html = ab.s;
+  take_log_Tex2Web (log, ret_log);
+  return good ? 1 : 0;
+}
+
+struct Tex2WebStream
+{
+  HtmlState st[1];
+  OSink sink[1];
+  OFile log[1];
+  HtPush push[1];
+  Tex2WebWriteFn fn;
+  void* fn_arg;
+};
+
+static
+  bool
+write_Tex2WebStream (void* arg, const char* s, zuint n)
+{
+  Tex2WebStream* stream = (Tex2WebStream*) arg;
+  return 0 != stream->fn (stream->fn_arg, s, n);
+}
+
+/** Start converting a document that is given in pieces.
+ * HTML is given to {fn} as soon as each part of the document is done,
+ * so it can be sent on while the rest of the text is still coming.
+ * Text is only kept until a blank line outside of any braces, math,
+ * code, table or alignment environment.
+ **/
+  Tex2WebStream*
+open_Tex2WebStream (const Tex2Web* t, Tex2WebWriteFn fn, void* arg)
+{
+  Tex2WebStream* stream = AllocT( Tex2WebStream, 1 );
+  stream->fn = fn;
+  stream->fn_arg = arg;
+  init_OFile (stream->log);
+  init_fn_OSink (stream->sink, write_Tex2WebStream, stream);
+  init_state_Tex2Web (stream->st, t, stream->sink, stream->log);
+  init_HtPush (stream->push, stream->st);
+  return stream;
+}
+
+/** Give the next {sz} bytes of the document, which may end anywhere.
+ * Return zero once the conversion has failed.
+ **/
+  int
+push_Tex2WebStream (Tex2WebStream* stream, const char* text, size_t sz)
+{
+  return push_HtPush (stream->push, text, sz) ? 1 : 0;
+}
+
+/** Convert the rest of the document and free {stream}.
+ * The problems found are given in {*ret_log} as for convert_Tex2Web().
+ * Return nonzero when the document converted without problems.
+ **/
+  int
+close_Tex2WebStream (Tex2WebStream* stream, char** ret_log)
+{
+  HtmlState* st = stream->st;
+  bool good = close_HtPush (stream->push);
+  if (!good && st->nbogs == 0)
+    oput_cstr_OFile (stream->log, "Failed to convert.\n");
+  lose_HtPush (stream->push);
+  lose_HtmlState (st);
+  take_log_Tex2Web (stream->log, ret_log);
+  free (stream);
+  return good ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+/**
+ * Output sinks that take whole segments at once.
+ **/
+
+#include "osink.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+/** Most segments given to one writev() call.**/
+#define OSinkMaxSegs 64
+
+static
+  void
+init_OSink (OSink* sink, OSinkKind kind)
+{
+  sink->kind = kind;
+  sink->fd = -1;
+  sink->of = 0;
+  sink->fn = 0;
+  sink->fn_arg = 0;
+  sink->good = true;
+  sink->nsyscalls = 0;
+  sink->nbytes = 0;
+  sink->ncopied = 0;
+}
+
+/** Write to {fd}, which the caller still owns.**/
+  void
+init_fd_OSink (OSink* sink, int fd)
+{
+  init_OSink (sink, OSinkFd);
+  sink->fd = fd;
+}
+
+/** Append to {of}, which the caller still owns.**/
+  void
+init_mem_OSink (OSink* sink, OFile* of)
+{
+  init_OSink (sink, OSinkMem);
+  sink->of = of;
+}
+
+  void
+init_count_OSink (OSink* sink)
+{
+  init_OSink (sink, OSinkCount);
+}
+
+/** Give each segment to {fn}, called with {arg}.**/
+  void
+init_fn_OSink (OSink* sink, OSinkWriteFn fn, void* arg)
+{
+  init_OSink (sink, OSinkFn);
+  sink->fn = fn;
+  sink->fn_arg = arg;
+}
+
+/** Write all of {segs} to the file descriptor,
+ * retrying after short writes and interrupts.
+ **/
+static
+  bool
+writev_fd_OSink (OSink* sink, const struct iovec* segs, uint nsegs)
+{
+  uint i = 0;
+  /* Bytes of {segs[i]} already written.*/
+  zuint off = 0;
+
+  while (i < nsegs) {
+    struct iovec iov[OSinkMaxSegs];
+    uint n = 0;
+    ssize_t ret;
+    zuint k;
+
+    for (uint j = i; j < nsegs && n < OSinkMaxSegs; ++j) {
+      const zuint skip = (j == i ? off : 0);
+      if (segs[j].iov_len == skip)
+        continue;
+      iov[n].iov_base = (char*) segs[j].iov_base + skip;
+      iov[n].iov_len = segs[j].iov_len - skip;
+      ++ n;
+    }
+    if (n == 0)
+      break;
+
+    ret = writev (sink->fd, iov, (int) n);
+    sink->nsyscalls += 1;
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      sink->good = false;
+      return false;
+    }
+
+    k = (zuint) ret;
+    while (i < nsegs && k >= segs[i].iov_len - off) {
+      k -= segs[i].iov_len - off;
+      off = 0;
+      ++ i;
+    }
+    off += k;
+  }
+  return true;
+}
+
+/** Write {nsegs} segments in order, as one writev() when possible.**/
+  bool
+writev_OSink (OSink* sink, const struct iovec* segs, uint nsegs)
+{
+  zuint total = 0;
+  for (i ; nsegs)
+    total += segs[i].iov_len;
+  if (!sink->good)
+    return false;
+  sink->nbytes += total;
+
+  switch (sink->kind)
+  {
+  case OSinkFd:
+    return writev_fd_OSink (sink, segs, nsegs);
+  case OSinkMem:
+    for (i ; nsegs)
+      oputn_char_OFile (sink->of, (const char*) segs[i].iov_base,
+                        segs[i].iov_len);
+    sink->ncopied += total;
+    break;
+  case OSinkCount:
+    break;
+  case OSinkFn:
+    for (i ; nsegs) {
+      if (segs[i].iov_len == 0)
+        continue;
+      if (!sink->fn (sink->fn_arg, (const char*) segs[i].iov_base,
+                     segs[i].iov_len)) {
+        sink->good = false;
+        return false;
+      }
+    }
+    break;
+  }
+  return true;
+}
+
+/** Add the counts of {src} to {dst}.**/
+  void
+add_stats_OSink (OSink* dst, const OSink* src)
+{
+  dst->nsyscalls += src->nsyscalls;
+  dst->nbytes += src->nbytes;
+  dst->ncopied += src->ncopied;
+}
+
+/** Write the counts of {sink} as a JSON object.**/
+  void
+oput_stats_OSink (OFile* of, const OSink* sink)
+{
+  printf_OFile (of, "{\"write_syscalls\":%lu,\"bytes\":%lu,"
+                "\"bytes_copied\":%lu}",
+                (unsigned long) sink->nsyscalls,
+                (unsigned long) sink->nbytes,
+                (unsigned long) sink->ncopied);
+}
@@ -0,0 +1,60 @@
+/**
+ * Output sinks that take whole segments at once.
+ **/
+#ifndef OSINK_H_
+#define OSINK_H_
+#include "cx/ofile.h"
+
+#include <sys/uio.h>
+
+/** Where an OSink sends its bytes.**/
+typedef enum OSinkKind OSinkKind;
+enum OSinkKind
+{
+  /** A file descriptor, written with writev().**/
+  OSinkFd,
+  /** An in-memory OFile.**/
+  OSinkMem,
+  /** Nowhere. Bytes are only counted.**/
+  OSinkCount,
+  /** A function that takes each segment.**/
+  OSinkFn
+};
+
+/** Take {n} bytes of {s}, returning false when they could not be written.**/
+typedef bool (*OSinkWriteFn) (void* arg, const char* s, zuint n);
+
+typedef struct OSink OSink;
+struct OSink
+{
+  OSinkKind kind;
+  int fd;
+  OFile* of;
+  OSinkWriteFn fn;
+  void* fn_arg;
+  /** False once a write has failed.**/
+  bool good;
+  /** Number of write system calls made.**/
+  zuint nsyscalls;
+  /** Number of bytes given to the sink.**/
+  zuint nbytes;
+  /** Number of bytes that the sink copied in memory.**/
+  zuint ncopied;
+};
+
+void
+init_fd_OSink (OSink* sink, int fd);
+void
+init_mem_OSink (OSink* sink, OFile* of);
+void
+init_count_OSink (OSink* sink);
+void
+init_fn_OSink (OSink* sink, OSinkWriteFn fn, void* arg);
+bool
+writev_OSink (OSink* sink, const struct iovec* segs, uint nsegs);
+void
+add_stats_OSink (OSink* dst, const OSink* src);
+void
+oput_stats_OSink (OFile* of, const OSink* sink);
+
+#endif
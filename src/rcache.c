@@ -0,0 +1,360 @@
+/**
+ * Rendered documents kept in a directory, keyed by content hashes.
+ *
+ * Each entry is one file named by its key.
+ * Entries are written to a temporary file and renamed into place,
+ * so processes sharing the directory only ever see whole entries.
+ **/
+
+#include "rcache.h"
+#include "osink.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Tag at the start of an entry, with its format version.**/
+#define RCacheMagic "t2wc0002"
+
+/*
+ * An entry holds, in host byte order:
+ *   RCacheMagic
+ *   u64 key
+ *   the HTML
+ *   u32 number of files read, each stored as:
+ *     u64 content hash, u8 1 if no file may be at the path,
+ *     u32 path size, then the path and a NUL
+ *   u64 HTML size.
+ * The HTML comes first so it can be written before the files are known.
+ */
+
+/** Hash {n} bytes at {s}, continuing from {h}.
+ * Bytes are taken 8 at a time, so this keeps up with reading.
+ **/
+  uint64_t
+hash_RCache (uint64_t h, const void* s, zuint n)
+{
+  const uint64_t m = 0x9e3779b97f4a7c15u;
+  const byte* p = (const byte*) s;
+  uint64_t w;
+
+  h = (h ^ (uint64_t) n) * m;
+  while (n >= sizeof (w)) {
+    memcpy (&w, p, sizeof (w));
+    h = (h ^ w) * m;
+    h ^= h >> 29;
+    p += sizeof (w);
+    n -= sizeof (w);
+  }
+  w = 0;
+  memcpy (&w, p, n);
+  h = (h ^ w) * m;
+  h ^= h >> 32;
+  return h;
+}
+
+/** Hash the content of the file at {path}
+ * the same way that hash_RCache() hashes text.
+ **/
+  bool
+hash_file_RCache (uint64_t* ret, const char* path)
+{
+  struct stat sb;
+  void* map;
+  int fd = open (path, O_RDONLY);
+
+  if (fd < 0)
+    return false;
+  if (0 != fstat (fd, &sb) || !S_ISREG(sb.st_mode)) {
+    close (fd);
+    return false;
+  }
+  if (sb.st_size == 0) {
+    close (fd);
+    *ret = hash_RCache (0, "", 0);
+    return true;
+  }
+  map = mmap (0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return false;
+  *ret = hash_RCache (0, map, sb.st_size);
+  munmap (map, sb.st_size);
+  return true;
+}
+
+/** Path of the entry for {key} in {dir}.**/
+static
+  void
+path_RCache (AlphaTab* path, const char* dir, uint64_t key)
+{
+  char name[17];
+  for (i ; 16)
+    name[i] = "0123456789abcdef"[(key >> (60 - 4 * i)) & 0xf];
+  name[16] = '\0';
+  cat_cstr_AlphaTab (path, dir);
+  cat_char_AlphaTab (path, '/');
+  cat_cstr_AlphaTab (path, name);
+  cat_cstr_AlphaTab (path, ".t2wc");
+}
+
+/** Reader over the bytes of an entry.**/
+typedef struct RCacheReader RCacheReader;
+struct RCacheReader
+{
+  const char* s;
+  zuint off;
+  zuint sz;
+  bool good;
+};
+
+/** Take the next {n} bytes.**/
+static
+  const char*
+take_RCacheReader (RCacheReader* in, zuint n)
+{
+  const char* s = &in->s[in->off];
+  if (!in->good || in->sz - in->off < n) {
+    in->good = false;
+    return 0;
+  }
+  in->off += n;
+  return s;
+}
+
+static
+  uint64_t
+u64_RCacheReader (RCacheReader* in)
+{
+  uint64_t x = 0;
+  const char* s = take_RCacheReader (in, sizeof (x));
+  if (s)
+    memcpy (&x, s, sizeof (x));
+  return x;
+}
+
+static
+  uint32_t
+u32_RCacheReader (RCacheReader* in)
+{
+  uint32_t x = 0;
+  const char* s = take_RCacheReader (in, sizeof (x));
+  if (s)
+    memcpy (&x, s, sizeof (x));
+  return x;
+}
+
+/** Check that nothing is at {path}.**/
+static
+  bool
+absent_path (const char* path)
+{
+  struct stat sb;
+  return (0 != stat (path, &sb));
+}
+
+  void
+init_RCacheEntry (RCacheEntry* entry)
+{
+  entry->map = 0;
+  entry->map_sz = 0;
+  entry->html = 0;
+  entry->html_sz = 0;
+  entry->deps = 0;
+  entry->ndeps = 0;
+}
+
+  void
+lose_RCacheEntry (RCacheEntry* entry)
+{
+  if (entry->map)
+    munmap (entry->map, entry->map_sz);
+  if (entry->deps)
+    free (entry->deps);
+  init_RCacheEntry (entry);
+}
+
+/** Open the entry for {key} in {dir}.
+ * This fails when there is no entry, when it is damaged,
+ * when a file that it read no longer has the same content,
+ * or when a file now exists where the document found none.
+ **/
+  bool
+open_RCacheEntry (RCacheEntry* entry, const char* dir, uint64_t key)
+{
+  AlphaTab path = dflt_AlphaTab ();
+  RCacheReader in[1];
+  struct stat sb;
+  const char* magic;
+  uint32_t ndeps;
+  int fd;
+
+  lose_RCacheEntry (entry);
+  path_RCache (&path, dir, key);
+  fd = open (ccstr_of_AlphaTab (&path), O_RDONLY);
+  lose_AlphaTab (&path);
+  if (fd < 0)
+    return false;
+  if (0 != fstat (fd, &sb) || !S_ISREG(sb.st_mode) || sb.st_size == 0) {
+    close (fd);
+    return false;
+  }
+  entry->map = mmap (0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (entry->map == MAP_FAILED) {
+    entry->map = 0;
+    return false;
+  }
+  entry->map_sz = sb.st_size;
+
+  in->s = (const char*) entry->map;
+  in->off = 0;
+  in->sz = entry->map_sz;
+  in->good = true;
+
+  magic = take_RCacheReader (in, strlen (RCacheMagic));
+  if (!magic || 0 != memcmp (magic, RCacheMagic, strlen (RCacheMagic)))
+    in->good = false;
+  if (u64_RCacheReader (in) != key)
+    in->good = false;
+  /* The HTML size is at the end.*/
+  if (in->good && in->sz - in->off >= sizeof (uint64_t)) {
+    uint64_t n;
+    in->sz -= sizeof (n);
+    memcpy (&n, &in->s[in->sz], sizeof (n));
+    entry->html_sz = n;
+  }
+  else {
+    in->good = false;
+  }
+  entry->html = take_RCacheReader (in, entry->html_sz);
+
+  ndeps = u32_RCacheReader (in);
+  /* Each file takes at least 14 bytes.*/
+  if (in->good && ndeps <= (in->sz - in->off) / 14)
+    entry->deps = AllocT( RCacheDep, ndeps + 1 );
+  else
+    in->good = false;
+  for (uint32_t i = 0; in->good && i < ndeps; ++i) {
+    const uint64_t hash = u64_RCacheReader (in);
+    const char* absent = take_RCacheReader (in, 1);
+    const uint32_t n = u32_RCacheReader (in);
+    const char* dep = take_RCacheReader (in, (zuint) n + 1);
+    uint64_t now = 0;
+    if (!dep || dep[n] != '\0')
+      in->good = false;
+    else if (absent[0] ? !absent_path (dep)
+             : (!hash_file_RCache (&now, dep) || now != hash))
+      in->good = false;
+    entry->deps[i].path = dep;
+    entry->deps[i].hash = hash;
+    entry->deps[i].absent = (in->good && absent[0]);
+    entry->ndeps = i + 1;
+  }
+
+  if (!in->good || in->off != in->sz) {
+    lose_RCacheEntry (entry);
+    return false;
+  }
+  return true;
+}
+
+static
+  void
+oput_u32_RCache (OFile* of, uint32_t x)
+{
+  oputn_char_OFile (of, (const char*) &x, sizeof (x));
+}
+
+static
+  void
+oput_u64_RCache (OFile* of, uint64_t x)
+{
+  oputn_char_OFile (of, (const char*) &x, sizeof (x));
+}
+
+/** Start the entry for {key} in {dir}.
+ * It is written to a temporary file in {dir} and only renamed
+ * into place by close_RCacheWriter(), so readers see either
+ * the old entry or the whole new one.
+ **/
+  bool
+open_RCacheWriter (RCacheWriter* w, const char* dir, uint64_t key)
+{
+  OFile head[] = default;
+  struct iovec segs[1];
+  int fd;
+
+  w->path = dflt_AlphaTab ();
+  w->tmp = dflt_AlphaTab ();
+  w->html_sz = 0;
+  path_RCache (&w->path, dir, key);
+  cat_cstr_AlphaTab (&w->tmp, ccstr_of_AlphaTab (&w->path));
+  cat_cstr_AlphaTab (&w->tmp, ".XXXXXX");
+  fd = mkstemp (w->tmp.s);
+  if (fd < 0) {
+    lose_AlphaTab (&w->tmp);
+    lose_AlphaTab (&w->path);
+    return false;
+  }
+  init_fd_OSink (w->sink, fd);
+
+  oputn_char_OFile (head, RCacheMagic, strlen (RCacheMagic));
+  oput_u64_RCache (head, key);
+  segs[0].iov_base = window2_OFile (head, 0, head->off).s;
+  segs[0].iov_len = head->off;
+  writev_OSink (w->sink, segs, 1);
+  lose_OFile (head);
+  return true;
+}
+
+/** Add HTML to the entry.**/
+  void
+writev_RCacheWriter (RCacheWriter* w, const struct iovec* segs, uint nsegs)
+{
+  for (i ; nsegs)
+    w->html_sz += segs[i].iov_len;
+  writev_OSink (w->sink, segs, nsegs);
+}
+
+/** Finish the entry with the files that the document read,
+ * or throw it away when {keep} is false.
+ **/
+  bool
+close_RCacheWriter (RCacheWriter* w, const RCacheDep* deps, uint ndeps,
+                    bool keep)
+{
+  OFile tail[] = default;
+  struct iovec segs[1];
+  bool good = keep && w->sink->good;
+
+  if (good) {
+    oput_u32_RCache (tail, ndeps);
+    for (i ; ndeps) {
+      const zuint n = strlen (deps[i].path);
+      oput_u64_RCache (tail, deps[i].hash);
+      oputn_char_OFile (tail, deps[i].absent ? "\1" : "\0", 1);
+      oput_u32_RCache (tail, (uint32_t) n);
+      oputn_char_OFile (tail, deps[i].path, n + 1);
+    }
+    oput_u64_RCache (tail, w->html_sz);
+    segs[0].iov_base = window2_OFile (tail, 0, tail->off).s;
+    segs[0].iov_len = tail->off;
+    good = (writev_OSink (w->sink, segs, 1) &&
+            0 == fchmod (w->sink->fd, 0644));
+  }
+  good = (0 == close (w->sink->fd)) && good;
+  if (good)
+    good = (0 == rename (ccstr_of_AlphaTab (&w->tmp),
+                         ccstr_of_AlphaTab (&w->path)));
+  if (!good)
+    unlink (ccstr_of_AlphaTab (&w->tmp));
+
+  lose_OFile (tail);
+  lose_AlphaTab (&w->tmp);
+  lose_AlphaTab (&w->path);
+  return good;
+}
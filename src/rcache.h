@@ -0,0 +1,67 @@
+/**
+ * Rendered documents kept in a directory, keyed by content hashes.
+ **/
+#ifndef RCACHE_H_
+#define RCACHE_H_
+#include "osink.h"
+
+#include <stdint.h>
+
+/** A file that a rendered document read, with the hash of its content,
+ * or a path that it looked for a file at and found nothing.
+ **/
+typedef struct RCacheDep RCacheDep;
+struct RCacheDep
+{
+  const char* path;
+  uint64_t hash;
+  bool absent;
+};
+
+/** A cache entry whose files all still have the recorded content.
+ * Its {html} points into a mapping of the entry file.
+ **/
+typedef struct RCacheEntry RCacheEntry;
+struct RCacheEntry
+{
+  void* map;
+  zuint map_sz;
+  const char* html;
+  zuint html_sz;
+  /** Files that the document read, with paths into the mapping.**/
+  RCacheDep* deps;
+  uint ndeps;
+};
+
+/** An entry being written.
+ * Its HTML goes straight to a temporary file as it is made,
+ * and the files that the document read are added at the end.
+ **/
+typedef struct RCacheWriter RCacheWriter;
+struct RCacheWriter
+{
+  AlphaTab path;
+  AlphaTab tmp;
+  OSink sink[1];
+  zuint html_sz;
+};
+
+uint64_t
+hash_RCache (uint64_t h, const void* s, zuint n);
+bool
+hash_file_RCache (uint64_t* ret, const char* path);
+void
+init_RCacheEntry (RCacheEntry* entry);
+void
+lose_RCacheEntry (RCacheEntry* entry);
+bool
+open_RCacheEntry (RCacheEntry* entry, const char* dir, uint64_t key);
+bool
+open_RCacheWriter (RCacheWriter* w, const char* dir, uint64_t key);
+void
+writev_RCacheWriter (RCacheWriter* w, const struct iovec* segs, uint nsegs);
+bool
+close_RCacheWriter (RCacheWriter* w, const RCacheDep* deps, uint ndeps,
+                    bool keep);
+
+#endif
@@ -4,1185 +4,6502 @@
  *
  * Usage example:
  *   tex2web < in.tex > out.html
+ *   tex2web -batch manifest.txt -j 8
+ *   tex2web -batch manifest.txt -watch
+ *   tex2web -x in.tex -o out.html -stats stats.json
+ *   tex2web -dump-preamble preamble.tex -o preamble.t2wp
+ *   tex2web -preamble preamble.t2wp -x in.tex -o out.html
+ *   tex2web -cache-dir .t2wcache -x in.tex -o out.html
+ *   tex2web -x in.tex -o out.html -MD out.d -write-if-changed
+ *   tex2web -x in.tex -o out.json -emit-ir json
+ *   producer | tex2web -stream -o out.html
+ *   tex2web -x big.tex -o big.html -j 64
  **/
 
+/* For pthread_getattr_np().*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "cx/syscx.h"
 #include "cx/fileb.h"
-#include "cx/associa.h"
+#include "arena.h"
+#include "htmlesc.h"
+#include "osink.h"
+#include "rcache.h"
+#include "tex2web.h"
 
-typedef struct HtmlState HtmlState;
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-static bool
-htbody (OFile* of, XFile* xf, HtmlState* st);
+/** Whether -stats is built in.
+ * Build with -DTex2WebStats=0 to leave out all of its counting.
+ **/
+#ifndef Tex2WebStats
+#define Tex2WebStats 1
+#endif
 
-struct HtmlState
+/** Whether allocator calls are counted for -stats.
+ * bench_tex2web counts them by wrapping the allocator and defining
+ * {thread_nallocs} before it includes this file.
+ * The tex2web binary keeps the allocator that it is linked with.
+ **/
+#ifndef Tex2WebCountAllocs
+#define Tex2WebCountAllocs 0
+#endif
+
+#if !Tex2WebCountAllocs
+#define thread_nallocs ((zuint) 0)
+#endif
+
+static
+  double
+now_sec ()
 {
-  bool allgood;
-  zuint nlines;
-  bool eol;
-  bool inparagraph;
-  bool end_document;
-  uint list_depth;
-  bool list_item_open;
-  Bool cram;
-  bool show_toc;
-  zuint toc_pos;
-  OFile* ofile;
-  uint nsections;
-  uint nsubsections;
-  AlphaTab pagetitle;
-  AlphaTab title;
-  AlphaTab author;
-  AlphaTab date;
-  OFile toc_ofile[1];
-  OFile body_ofile[1];
-  const char* pathname;
-  TableT(AlphaTab) search_paths;
-  Associa macro_map;
-  AlphaTab css_filepath;
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+typedef struct InFile InFile;
+
+/** An input file, memory mapped when possible.
+ *
+ * Regular files are mapped privately, so the parser's writes into its
+ * input (such as NUL-terminating tokens) copy only the pages they touch
+ * and never reach the file.
+ * Pipes and other special files fall back to buffered reads.
+ **/
+struct InFile
+{
+  /** Where to read from, either {olay} or {xfb->xf}.**/
+  XFile* xf;
+  XFile olay[1];
+  XFileB xfb[1];
+  void* map;
+  zuint map_sz;
+  /** Text from an include callback, or null.**/
+  char* text;
+  /** Directory of the file, for opening files relative to it.**/
+  AlphaTab pathname;
 };
 
 static
   void
-init_HtmlState (HtmlState* st, OFile* ofile)
+init_InFile (InFile* in)
 {
-  st->allgood = true;
-  st->nlines = 1;
-  st->eol = true;
-  st->inparagraph = false;
-  st->end_document = false;
-  st->list_depth = 0;
-  st->list_item_open = false;
-  st->cram = false;
-  st->show_toc = false;
-  st->toc_pos = 0;
-  st->ofile = ofile;
-  st->nsections = 0;
-  st->nsubsections = 0;
-  st->pagetitle = dflt_AlphaTab ();
-  st->title = dflt_AlphaTab ();
-  st->author = dflt_AlphaTab ();
-  st->date = dflt_AlphaTab ();
-  init_OFile (st->toc_ofile);
-  init_OFile (st->body_ofile);
-  st->pathname = 0;
-  InitTable( st->search_paths );
-  InitAssocia( AlphaTab, AlphaTab, st->macro_map, cmp_AlphaTab );
-  st->css_filepath = dflt_AlphaTab ();
+  XFileB xfb = default;
+  in->xf = 0;
+  *in->xfb = xfb;
+  in->map = 0;
+  in->map_sz = 0;
+  in->text = 0;
+  in->pathname = dflt_AlphaTab ();
 }
 
 static
   void
-lose_HtmlState (HtmlState* st)
+lose_InFile (InFile* in)
 {
-  lose_AlphaTab (&st->pagetitle);
-  lose_AlphaTab (&st->title);
-  lose_AlphaTab (&st->author);
-  lose_AlphaTab (&st->date);
-  lose_OFile (st->toc_ofile);
-  lose_OFile (st->body_ofile);
-  for (i ; st->search_paths.sz)
-    lose_AlphaTab (&st->search_paths.s[i]);
-  LoseTable( st->search_paths );
-
-  for (Assoc* item = beg_Associa (&st->macro_map); item; )
-  {
-    AlphaTab* key = (AlphaTab*) key_of_Assoc (&st->macro_map, item);
-    AlphaTab* val = (AlphaTab*) val_of_Assoc (&st->macro_map, item);
-    Assoc* tmp = item;
-    item = next_Assoc (item);
-
-    give_Associa (&st->macro_map, tmp);
-    lose_AlphaTab (key);
-    lose_AlphaTab (val);
-  }
-  lose_Associa (&st->macro_map);
-  lose_AlphaTab (&st->css_filepath);
+  if (in->map)
+    munmap (in->map, in->map_sz);
+  if (in->text)
+    free (in->text);
+  lose_XFileB (in->xfb);
+  lose_AlphaTab (&in->pathname);
+  init_InFile (in);
 }
 
-#define W(s)  oput_cstr_OFile (ofile, s)
+/** Join a directory and a filename like open_FileB() does.**/
 static
   void
-css_html (HtmlState* st)
+cat_filepath_AlphaTab (AlphaTab* path, const char* dir, const char* filename)
 {
-  OFile* ofile = st->ofile;
-  W("\npre {");
-  W("\n  padding-left: 3em;");
-  W("\n  white-space: pre-wrap;");
-  //W("\n  white-space: -moz-pre-wrap;");
-  //W("\n  white-space: -o-pre-wrap;");
-  W("\n  display: block;");
-  W("\n}");
-  W("\npre.cram, ol.cram, ul.cram {");
-  W("\n  margin-top: -1em;");
-  W("\n}");
-  W("\np.cram { margin-top: -0.5em; }");
-  W("\nspan.underline { text-decoration: underline; }");
-  W("\nspan.texttt, span.ttvbl {");
-  W("\n  font-family:\"Courier New\", Monospace;");
-  W("\n}");
-  //W("\npre.shortb {");
-  //W("\n  margin-bottom: -1em;");
-  //W("\n}");
-  W("\npre, code {");
-  W("\n  background-color: #E2E2E2;");
-  W("\n}");
-  W("\na.texturl:link, a.texturl:visited {");
-  W("\n  color: black;");
-  W("\n  text-decoration: none;");
-  W("\n}");
-  W("\na.texturl:hover {");
-  W("\n  color: blue;");
-  W("\n  text-decoration: underline;");
-  W("\n}");
-  W("\ntable {");
-  W("\n  border-spacing: 0;");
-  W("\n  border-collapse: collapse;");
-  W("\n}");
-  W("\ntd {");
-  W("\n  padding: 0.3em;");
-  W("\n  text-align: left;");
-  W("\n}");
-  W("\n.ljust { text-align: left; }");
-  W("\n.cjust { text-align: center; }");
-  W("\n.rjust { text-align: right; }");
-  W("\ntd.lline { border-left: thin solid black; }");
-  W("\ntd.rline { border-right: thin solid black; }");
-  W("\ntr.hline { border-top: thin solid black; }");
+  if (dir && dir[0] != '\0' && filename[0] != '/') {
+    cat_cstr_AlphaTab (path, dir);
+    cat_char_AlphaTab (path, '/');
+  }
+  cat_cstr_AlphaTab (path, filename);
 }
 
+/** Map a regular file with a NUL byte after its content.
+ *
+ * An anonymous mapping one byte larger than the file is reserved first
+ * and the file is mapped over its start.
+ * This way the terminating byte is zero even when the file size is
+ * a multiple of the page size.
+ **/
 static
-  void
-head_html (HtmlState* st)
+  bool
+map_InFile (InFile* in, const char* path)
 {
-  OFile* ofile = st->ofile;
-  //W("<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Transitional//EN\" \"http://www.w3.org/TR/xhtml1/DTD/xhtml1-transitional.dtd\">");
-  //W("<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML Basic 1.0//EN\" \"http://www.w3.org/TR/xhtml-basic/xhtml-basic10.dtd\">");
-  W("<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML-Print 1.0//EN\" \"http://www.w3.org/MarkUp/DTD/xhtml-print10.dtd\">");
-  W("\n<html xmlns=\"http://www.w3.org/1999/xhtml\">");
-  W("\n<head>");
-  W("\n<meta http-equiv=\"Content-Type\" content=\"text/html;charset=utf-8\" />");
+  struct stat sb;
+  const zuint pagesz = (zuint) sysconf (_SC_PAGESIZE);
+  zuint sz;
+  byte* base;
+  int fd = open (path, O_RDONLY);
 
-  if (empty_ck_AlphaTab (&st->css_filepath)) {
-    //W("<style media=\"screen\" type=\"text/css\">\n");
-    W("\n<style type=\"text/css\">");
-    css_html (st);
-    W("\n</style>");
+  if (fd < 0)
+    return false;
+  if (0 != fstat (fd, &sb) || !S_ISREG(sb.st_mode) || sb.st_size == 0) {
+    close (fd);
+    return false;
   }
-  else {
-    W("\n<link rel=\"stylesheet\" type=\"text/css\" href=\"");
-    W(ccstr_of_AlphaTab (&st->css_filepath));
-    W("\">");
+
+  sz = (zuint) sb.st_size;
+  in->map_sz = (sz + 1 + pagesz - 1) / pagesz * pagesz;
+  base = (byte*) mmap (0, in->map_sz, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    close (fd);
+    return false;
+  }
+  if (MAP_FAILED == mmap (base, sz, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED, fd, 0))
+  {
+    munmap (base, in->map_sz);
+    close (fd);
+    return false;
   }
+  close (fd);
+  madvise (base, in->map_sz, MADV_SEQUENTIAL);
 
-  W("\n<title>"); oput_AlphaTab (ofile, &st->pagetitle); W("</title>");
-  W("\n</head>");
-  W("\n<body>");
+  in->map = base;
+  {
+    AlphaTab ab = dflt_AlphaTab ();
+    ab.s = (char*) base;
+    ab.sz = sz + 1;
+    init_XFile_olay_AlphaTab (in->olay, &ab);
+  }
+  in->xf = in->olay;
+  return true;
+}
 
-  W("\n<div class=\"cjust\">");
-  W("\n<h1>"); oput_AlphaTab (ofile, &st->title); W("</h1>");
-  if (!empty_ck_AlphaTab(&st->author)) {
-    W("\n<div>by "); oput_AlphaTab (ofile, &st->author); W("</div>");
+/** Open {filename} relative to the directory {dir}.**/
+static
+  bool
+open_InFile (InFile* in, const char* dir, const char* filename)
+{
+  AlphaTab path = dflt_AlphaTab ();
+  bool good;
+
+  lose_InFile (in);
+  cat_filepath_AlphaTab (&path, dir, filename);
+  good = map_InFile (in, ccstr_of_AlphaTab (&path));
+  if (good) {
+    const char* s = ccstr_of_AlphaTab (&path);
+    const char* slash = strrchr (s, '/');
+    if (slash) {
+      /* Keep "/" for files in the root directory.*/
+      const zuint n = (slash == s ? 1 : (zuint) (slash - s));
+      cat_cstr_AlphaTab (&in->pathname, s);
+      in->pathname.s[n] = '\0';
+      in->pathname.sz = n + 1;
+    }
+    else {
+      cat_cstr_AlphaTab (&in->pathname, "");
+    }
   }
-  if (!empty_ck_AlphaTab(&st->date)) {
-    W("\n<div>"); oput_AlphaTab (ofile, &st->date); W("</div>");
+  else {
+    good = open_FileB (&in->xfb->fb, dir, filename);
+    if (good) {
+      xget_XFile (&in->xfb->xf);
+      copy_AlphaTab (&in->pathname, &in->xfb->fb.pathname);
+      in->xf = &in->xfb->xf;
+    }
   }
-  W("\n</div>");
+  lose_AlphaTab (&path);
+  return good;
 }
 
+/** Read {name} through an include callback instead of the file system.**/
 static
-  void
-foot_html (HtmlState* st)
+  bool
+include_InFile (InFile* in, Tex2WebIncludeFn fn, void* arg, const char* name)
 {
-  OFile* ofile = st->ofile;
-  AlphaTab ab = window2_OFile (st->body_ofile, 0, st->toc_pos);
-  oput_AlphaTab (st->ofile, &ab);
+  lose_InFile (in);
+  in->text = fn (arg, name);
+  if (!in->text)
+    return false;
+  {
+    AlphaTab ab = dflt_AlphaTab ();
+    ab.s = in->text;
+    ab.sz = strlen (in->text) + 1;
+    init_XFile_olay_AlphaTab (in->olay, &ab);
+  }
+  in->xf = in->olay;
+  cat_cstr_AlphaTab (&in->pathname, "");
+  return true;
+}
 
-  if (st->show_toc) {
-    oput_cstr_OFile (ofile, "<p>Contents</p>");
-    oput_OFile (ofile, st->toc_ofile);
-    if (st->nsubsections > 0)
-      oput_cstr_OFile (ofile, "</li></ol>");
-    oput_cstr_OFile (ofile, "</li></ol>");
+/** Create or truncate {filename} relative to the directory {dir}
+ * and open it for writing.
+ **/
+static
+  int
+open_output_fd (const char* dir, const char* filename)
+{
+  AlphaTab path = dflt_AlphaTab ();
+  int fd;
+  cat_filepath_AlphaTab (&path, dir, filename);
+  fd = open (ccstr_of_AlphaTab (&path), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  lose_AlphaTab (&path);
+  return fd;
+}
+
+/** Check whether the file {filename} holds exactly the {n} bytes at {s}.**/
+static
+  bool
+same_content_ck (const char* filename, const char* s, zuint n)
+{
+  struct stat sb;
+  bool same = false;
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (0 == fstat (fd, &sb) && S_ISREG(sb.st_mode) &&
+      (zuint) sb.st_size == n)
+  {
+    if (n == 0) {
+      same = true;
+    }
+    else {
+      void* map = mmap (0, n, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        same = (0 == memcmp (map, s, n));
+        munmap (map, n);
+      }
+    }
   }
+  close (fd);
+  return same;
+}
 
-  ab = window2_OFile (st->body_ofile, st->toc_pos, st->body_ofile->off);
-  oput_AlphaTab (st->ofile, &ab);
+/** Write the text of {of} to {filename}.
+ * When the file already holds that text, it is left alone
+ * so that its modification time does not change.
+ * Counts of the write are added to {stats}.
+ **/
+static
+  bool
+write_if_changed (const char* filename, OFile* of, OSink* stats)
+{
+  OSink sink[1];
+  struct iovec segs[1];
+  const char* s = (of->off > 0 ? window2_OFile (of, 0, of->off).s : "");
+  int fd;
 
-  //W("<p><a href=\"http://validator.w3.org/check?uri=referer\">Valid XHTML-Print 1.0</a></p>\n");
-  W("\n</body>");
-  W("\n</html>\n");
+  if (same_content_ck (filename, s, of->off))
+    return true;
+  fd = open_output_fd (0, filename);
+  if (fd < 0)
+    return false;
+  init_fd_OSink (sink, fd);
+  segs[0].iov_base = (char*) s;
+  segs[0].iov_len = of->off;
+  writev_OSink (sink, segs, 1);
+  add_stats_OSink (stats, sink);
+  return (0 == close (fd)) && sink->good;
 }
-#undef W
 
-static void
-escape_for_html (OFile* of, XFile* xf, Associa* macro_map);
+typedef struct TexIndex TexIndex;
 
-static void
-handle_macro (OFile* of, XFile* xf, Associa* macro_map)
+/** Structural index of TeX text.
+ *
+ * One pass over the text records where the special characters are and
+ * pairs up the braces.
+ * Finding the next special character or a closing brace is then
+ * a lookup instead of another scan.
+ * Bit {i} of each bitmap describes the byte at {base[i]}.
+ **/
+struct TexIndex
 {
-  static const char macro_delims[] = "{}()[]\\/. \n\t_";
-  char* pos = tods_XFile (xf, macro_delims);
-  const char* sym_cstr = ccstr_of_XFile (xf);
-  char match = pos[0];
-  AlphaTab sym[1];
-  Assoc* macro_item;
+  char* base;
+  zuint sz;
+  /** Characters that end plain text in htbody(), see {TexStopChars}.**/
+  uint64_t* stops;
+  /** Opening braces.**/
+  uint64_t* opens;
+  /** Number of opening braces before each word of {opens}.**/
+  zuint* open_ranks;
+  /** Offset of the closing brace for each opening brace,
+   * or {MAX_ZUINT} when it has none.
+   **/
+  zuint* closes;
+};
 
-  if (sym_cstr == pos) {
-    switch (match) {
-    case '\\':
-      oput_char_OFile (of, '\n');
+#define TexStopChars "\n\\%$-"
+
+static
+  void
+init_TexIndex (TexIndex* idx)
+{
+  idx->base = 0;
+  idx->sz = 0;
+  idx->stops = 0;
+  idx->opens = 0;
+  idx->open_ranks = 0;
+  idx->closes = 0;
+}
+
+static
+  void
+lose_TexIndex (TexIndex* idx)
+{
+  free (idx->stops);
+  free (idx->opens);
+  free (idx->open_ranks);
+  free (idx->closes);
+  init_TexIndex (idx);
+}
+
+/** Classify 64 bytes at once.**/
+static
+  void
+classify_TexIndex (const char* s, uint64_t* ret_stops,
+                   uint64_t* ret_opens, uint64_t* ret_closes)
+{
+  uint64_t stops = 0;
+  uint64_t opens = 0;
+  uint64_t closes = 0;
+#if defined(__AVX2__)
+  for (uint i = 0; i < 64; i += 32) {
+    const __m256i v = _mm256_loadu_si256 ((const __m256i*) &s[i]);
+    __m256i m = _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\n'));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('\\')));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('%')));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('$')));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('-')));
+    stops |= (uint64_t) (uint) _mm256_movemask_epi8 (m) << i;
+    m = _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('{'));
+    opens |= (uint64_t) (uint) _mm256_movemask_epi8 (m) << i;
+    m = _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 ('}'));
+    closes |= (uint64_t) (uint) _mm256_movemask_epi8 (m) << i;
+  }
+#elif defined(__SSE2__)
+  for (uint i = 0; i < 64; i += 16) {
+    const __m128i v = _mm_loadu_si128 ((const __m128i*) &s[i]);
+    __m128i m = _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\n'));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\\')));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('%')));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('$')));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('-')));
+    stops |= (uint64_t) (uint) _mm_movemask_epi8 (m) << i;
+    m = _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('{'));
+    opens |= (uint64_t) (uint) _mm_movemask_epi8 (m) << i;
+    m = _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('}'));
+    closes |= (uint64_t) (uint) _mm_movemask_epi8 (m) << i;
+  }
+#else
+  for (uint i = 0; i < 64; ++i) {
+    const uint64_t bit = (uint64_t) 1 << i;
+    switch (s[i]) {
+    case '\n': case '\\': case '%': case '$': case '-':
+      stops |= bit;
       break;
-    case '_':
-    case '%':
-      oput_char_OFile (of, match);
+    case '{':
+      opens |= bit;
       break;
-    default:
-      DBog1( "I don't yet understand: \\%c", match );
+    case '}':
+      closes |= bit;
       break;
     }
+  }
+#endif
+  *ret_stops = stops;
+  *ret_opens = opens;
+  *ret_closes = closes;
+}
 
-    if (match)
-      offto_XFile (xf, &pos[1]);
-    return;
+/** Index the NUL-terminated text at {s}.**/
+static
+  void
+build_TexIndex (TexIndex* idx, char* s)
+{
+  const zuint sz = strlen (s);
+  const zuint nwords = (sz + 63) / 64;
+  zuint nopens = 0;
+  /* Innermost unmatched opening brace. Enclosing ones are linked
+   * through {closes} until they are matched.
+   */
+  zuint top = MAX_ZUINT;
+  TableT(zuint) closes = DEFAULT_Table;
+
+  lose_TexIndex (idx);
+  idx->base = s;
+  idx->sz = sz;
+  idx->stops = AllocT( uint64_t, nwords+1 );
+  idx->opens = AllocT( uint64_t, nwords+1 );
+  idx->open_ranks = AllocT( zuint, nwords+1 );
+
+  for (w ; nwords) {
+    uint64_t opens, closes_bits, braces;
+    if (sz - w*64 >= 64) {
+      classify_TexIndex (&s[w*64], &idx->stops[w], &opens, &closes_bits);
+    }
+    else {
+      char tail[64];
+      memset (tail, 0, sizeof (tail));
+      memcpy (tail, &s[w*64], sz - w*64);
+      classify_TexIndex (tail, &idx->stops[w], &opens, &closes_bits);
+    }
+    idx->opens[w] = opens;
+    idx->open_ranks[w] = nopens;
+
+    braces = opens | closes_bits;
+    while (braces) {
+      const uint b = (uint) __builtin_ctzll (braces);
+      const uint64_t bit = (uint64_t) 1 << b;
+      braces &= braces - 1;
+      if (opens & bit) {
+        PushTable( closes, top );
+        top = nopens++;
+      }
+      else if (top != MAX_ZUINT) {
+        const zuint k = top;
+        top = closes.s[k];
+        closes.s[k] = w*64 + b;
+      }
+    }
   }
-  pos[0] = '\0';
-  *sym = dflt1_AlphaTab (sym_cstr);
+  /* Sentinel word so lookups at the very end stay in bounds.*/
+  idx->stops[nwords] = 0;
+  idx->opens[nwords] = 0;
+  idx->open_ranks[nwords] = nopens;
 
-  macro_item = lookup_Associa (macro_map, sym);
-  if (macro_item) {
-    XFile olay[1];
-    AlphaTab* val = (AlphaTab*) val_of_Assoc (macro_map, macro_item);
-    init_XFile_olay_AlphaTab (olay, val);
-    escape_for_html (of, olay, macro_map);
+  while (top != MAX_ZUINT) {
+    const zuint k = top;
+    top = closes.s[k];
+    closes.s[k] = MAX_ZUINT;
+  }
+  idx->closes = closes.s;
+}
+
+/** Offset of {p} in the index, or {MAX_ZUINT} when it is not indexed.**/
+static inline
+  zuint
+off_TexIndex (const TexIndex* idx, const char* p)
+{
+  if (!idx || !idx->base || p < idx->base || p >= &idx->base[idx->sz])
+    return MAX_ZUINT;
+  return (zuint) (p - idx->base);
+}
+
+/** Offset in the index where the text of {xf} ends.
+ * The parser writes NULs to end the pieces it splits off,
+ * so the text of {xf} can end well before the indexed text does.
+ * Its buffer ends there, so nothing needs to be searched.
+ **/
+static inline
+  zuint
+end_TexIndex (const TexIndex* idx, const XFile* xf)
+{
+  const char* e = &xf->buf.s[xf->buf.sz];
+  if (e < idx->base)
+    return 0;
+  if (e > &idx->base[idx->sz])
+    return idx->sz;
+  return (zuint) (e - idx->base);
+}
+
+/** Make {olay} hold {xf}'s text up to offset {off} of the index,
+ * which is replaced by a NUL.
+ * This fails when the text of {xf} ends before there.
+ **/
+static
+  bool
+cut_olay_TexIndex (const TexIndex* idx, XFile* olay, XFile* xf,
+                   zuint beg, zuint off)
+{
+  char* s = &idx->base[beg];
+  AlphaTab ab = dflt_AlphaTab ();
+  if (off >= end_TexIndex (idx, xf))
+    return false;
+  idx->base[off] = '\0';
+  offto_XFile (xf, &idx->base[off+1]);
+  ab.s = s;
+  ab.sz = off - beg + 1;
+  init_XFile_olay_AlphaTab (olay, &ab);
+  return true;
+}
+
+/** Like nextds_olay_XFile() with {TexStopChars} as delimiters.**/
+static
+  bool
+nextstop_olay_TexIndex (const TexIndex* idx, XFile* olay, XFile* xf,
+                        char* ret_match)
+{
+  const zuint beg = off_TexIndex (idx, ccstr_of_XFile (xf));
+  if (beg != MAX_ZUINT) {
+    const zuint nwords = (idx->sz + 63) / 64;
+    zuint w = beg / 64;
+    uint64_t bits = idx->stops[w] & (~(uint64_t) 0 << (beg % 64));
+    while (!bits && ++w < nwords)
+      bits = idx->stops[w];
+    if (bits) {
+      const zuint off = w*64 + (zuint) __builtin_ctzll (bits);
+      const char match = idx->base[off];
+      if (match != '\0' && cut_olay_TexIndex (idx, olay, xf, beg, off)) {
+        *ret_match = match;
+        return true;
+      }
+    }
+  }
+  return nextds_olay_XFile (olay, xf, ret_match, TexStopChars);
+}
+
+/** Like getmatchd_olay_XFile() with braces,
+ * where the opening brace was just read from {xf}.
+ **/
+static
+  bool
+getbraced_olay_TexIndex (const TexIndex* idx, XFile* olay, XFile* xf)
+{
+  const zuint beg = off_TexIndex (idx, ccstr_of_XFile (xf));
+  if (beg != MAX_ZUINT && beg > 0 && idx->base[beg-1] == '{') {
+    const zuint o = beg - 1;
+    const uint64_t below = ((uint64_t) 1 << (o % 64)) - 1;
+    const zuint k = idx->open_ranks[o / 64]
+      + (zuint) __builtin_popcountll (idx->opens[o / 64] & below);
+    const zuint off = idx->closes[k];
+    if (off != MAX_ZUINT && idx->base[off] == '}' &&
+        cut_olay_TexIndex (idx, olay, xf, beg, off))
+      return true;
+  }
+  return getmatchd_olay_XFile (olay, xf, "{", "}");
+}
+
+/** Flags of getenv_olay_TexIndex().**/
+enum TexEnvFlag
+{
+  /** The \end must start a line. The newline before it is dropped too.
+   * A nested \begin or \end only counts when it starts a line.
+   **/
+  TexEnv_Eol = 1 << 0,
+  /** A \begin of the same name opens a nested environment.**/
+  TexEnv_Nest = 1 << 1
+};
+
+/** Classify the command at {p} in the text starting at {s}.
+ * Returns 1 when it begins a nested environment {name},
+ * -1 when it can end one, and 0 otherwise.
+ **/
+static inline
+  Sign
+env_cmd_TexIndex (const char* s, const char* p,
+                  const char* name, zuint name_sz, uint flags)
+{
+  if ((flags & TexEnv_Eol) && !(p > s && p[-1] == '\n'))
+    return 0;
+  if ((flags & TexEnv_Nest) &&
+      0 == strncmp (&p[1], "begin{", 6) &&
+      0 == strncmp (&p[7], name, name_sz) &&
+      p[7+name_sz] == '}')
+    return 1;
+  if (0 == strncmp (&p[1], "end{", 4) &&
+      0 == strncmp (&p[5], name, name_sz) &&
+      p[5+name_sz] == '}')
+    return -1;
+  return 0;
+}
+
+/** Make {olay} hold the content of the environment {name},
+ * whose \begin was just read from {xf}, and skip {xf} past its \end.
+ *
+ * Only backslashes are visited, by way of the index when it covers {xf}.
+ * This fails when {xf} ends before the environment does.
+ **/
+static
+  bool
+getenv_olay_TexIndex (const TexIndex* idx, XFile* olay, XFile* xf,
+                      const char* name, uint flags)
+{
+  char* const s = cstr_of_XFile (xf);
+  const zuint name_sz = strlen (name);
+  const zuint beg = off_TexIndex (idx, s);
+  char* p = 0;
+  uint depth = 0;
+
+  if (beg != MAX_ZUINT) {
+    const zuint nwords = (idx->sz + 63) / 64;
+    const char* const end = &idx->base[end_TexIndex (idx, xf)];
+    zuint w = beg / 64;
+    uint64_t bits = idx->stops[w] & (~(uint64_t) 0 << (beg % 64));
+    while (!p) {
+      while (!bits && ++w < nwords)
+        bits = idx->stops[w];
+      if (!bits)
+        break;
+      {
+        char* q = &idx->base[w*64 + (zuint) __builtin_ctzll (bits)];
+        bits &= bits - 1;
+        if (q >= end)
+          break;
+        if (*q == '\\') {
+          const Sign c = env_cmd_TexIndex (s, q, name, name_sz, flags);
+          if (c > 0)
+            ++ depth;
+          else if (c < 0 && depth == 0)
+            p = q;
+          else if (c < 0)
+            -- depth;
+        }
+      }
+    }
+  }
+  else {
+    char* q;
+    for (q = strchr (s, '\\'); q && !p; q = strchr (&q[1], '\\')) {
+      const Sign c = env_cmd_TexIndex (s, q, name, name_sz, flags);
+      if (c > 0)
+        ++ depth;
+      else if (c < 0 && depth == 0)
+        p = q;
+      else if (c < 0)
+        -- depth;
+    }
+  }
+
+  if (!p)
+    return false;
+  {
+    char* e = (flags & TexEnv_Eol) ? &p[-1] : p;
+    AlphaTab ab = dflt_AlphaTab ();
+    e[0] = '\0';
+    offto_XFile (xf, &p[6+name_sz]);
+    ab.s = s;
+    ab.sz = (zuint) (e - s) + 1;
+    init_XFile_olay_AlphaTab (olay, &ab);
+  }
+  return true;
+}
+
+/** FNV-1a hash of the {n} bytes at {s}.**/
+static
+  uint
+hash_chars (const char* s, uint n)
+{
+  uint h = 2166136261u;
+  for (uint i = 0; i < n; ++i) {
+    h ^= (byte) s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+typedef struct MacroPiece MacroPiece;
+typedef struct Macro Macro;
+typedef struct MacroMap MacroMap;
+
+/** Most arguments a macro can take, as in TeX.**/
+#define MaxMacroArgs 9
+/** Bytes of stack to leave free below the deepest nesting,
+ * for a handler and the library calls it makes, such as fopen().
+ **/
+#define StackMarginSz ((zuint) 64 << 10)
+/** Most commands, environments, \input files and macro arguments
+ * that can be parsed inside each other when the stack of the thread
+ * cannot be measured. Each level takes under 1 KiB of stack,
+ * so this fits within a 512 KiB thread stack along with StackMarginSz.
+ **/
+#define MaxBodyDepth 256
+
+/** Part of the value of a macro with arguments:
+ * argument number {arg} when that is nonzero,
+ * otherwise {sz} bytes of the macro's HTML at {off}.
+ **/
+struct MacroPiece
+{
+  zuint off;
+  zuint sz;
+  uint arg;
+};
+DeclTableT( MacroPiece, MacroPiece );
+
+/** A macro from \newcommand or -def.
+ * Its value is kept as finished HTML, so using it is a copy.
+ **/
+struct Macro
+{
+  AlphaTab name;
+  uint name_sz;
+  uint hash;
+  AlphaTab html;
+  zuint html_sz;
+  /** The value for an attribute, where single quotes are escaped too.
+   * It is only set when the value has a single quote.
+   **/
+  AlphaTab attr;
+  zuint attr_sz;
+  /** Number of arguments.**/
+  uint nargs;
+  /** When there are arguments, the template that joins them
+   * with the pieces of {html}.
+   **/
+  TableT(MacroPiece) pieces;
+  /** Hash of the name and value, see fingerprint_MacroMap().**/
+  uint64_t fingerprint;
+};
+DeclTableT( Macro, Macro );
+
+/** Macros by name.
+ *
+ * Names are interned: the ID of a name is its index in {macros},
+ * and {slots} is an open-addressed index from names to IDs.
+ * Each slot holds one plus an ID, or zero when empty.
+ **/
+struct MacroMap
+{
+  TableT(Macro) macros;
+  uint* slots;
+  /** Number of slots, a power of 2.**/
+  uint nslots;
+  /** XOR of the fingerprints of all macros.
+   * It does not depend on the order of definitions,
+   * so equal macro tables have equal fingerprints.
+   **/
+  uint64_t fingerprint;
+};
+
+#define MacroMapMinSlots 64
+
+static
+  void
+init_MacroMap (MacroMap* map)
+{
+  InitTable( map->macros );
+  map->fingerprint = 0;
+  map->nslots = MacroMapMinSlots;
+  map->slots = AllocT( uint, map->nslots );
+  memset (map->slots, 0, map->nslots * sizeof (uint));
+}
+
+/** Remove all macros, keeping the memory of {map->slots}.**/
+static
+  void
+clear_MacroMap (MacroMap* map)
+{
+  for (i ; map->macros.sz) {
+    Macro* macro = &map->macros.s[i];
+    lose_AlphaTab (&macro->name);
+    lose_AlphaTab (&macro->html);
+    lose_AlphaTab (&macro->attr);
+    LoseTable( macro->pieces );
+  }
+  map->macros.sz = 0;
+  map->fingerprint = 0;
+  memset (map->slots, 0, map->nslots * sizeof (uint));
+}
+
+static
+  void
+lose_MacroMap (MacroMap* map)
+{
+  clear_MacroMap (map);
+  LoseTable( map->macros );
+  free (map->slots);
+}
+
+/** Add the ID {id} to the index of {map}.**/
+static
+  void
+slot_MacroMap (MacroMap* map, uint id)
+{
+  const uint mask = map->nslots - 1;
+  uint h = map->macros.s[id].hash & mask;
+  while (map->slots[h] != 0)
+    h = (h + 1) & mask;
+  map->slots[h] = id + 1;
+}
+
+/** Find the macro named by the {n} bytes at {s}, which hash to {hash}.**/
+static
+  Macro*
+find_hashed_MacroMap (MacroMap* map, const char* s, uint n, uint hash)
+{
+  const uint mask = map->nslots - 1;
+  uint h = hash & mask;
+  while (map->slots[h] != 0) {
+    Macro* macro = &map->macros.s[map->slots[h] - 1];
+    if (macro->hash == hash && macro->name_sz == n &&
+        0 == memcmp (ccstr_of_AlphaTab (&macro->name), s, n))
+      return macro;
+    h = (h + 1) & mask;
+  }
+  return 0;
+}
+
+/** Find the macro named by the {n} bytes at {s}.**/
+static
+  Macro*
+find_MacroMap (MacroMap* map, const char* s, uint n)
+{
+  return find_hashed_MacroMap (map, s, n, hash_chars (s, n));
+}
+
+/** Add a macro with an empty value, named {name} of {n} bytes
+ * that hash to {hash}. The map takes {name}.
+ **/
+static
+  Macro*
+add_MacroMap (MacroMap* map, AlphaTab name, uint n, uint hash)
+{
+  Macro* macro;
+  /* Keep the index at most half full.*/
+  if (2 * (map->macros.sz + 1) > map->nslots) {
+    free (map->slots);
+    map->nslots *= 2;
+    map->slots = AllocT( uint, map->nslots );
+    memset (map->slots, 0, map->nslots * sizeof (uint));
+    for (i ; map->macros.sz)
+      slot_MacroMap (map, i);
+  }
+
+  macro = Grow1Table( map->macros );
+  macro->name = name;
+  macro->name_sz = n;
+  macro->hash = hash;
+  macro->html = dflt_AlphaTab ();
+  macro->html_sz = 0;
+  macro->attr = dflt_AlphaTab ();
+  macro->attr_sz = 0;
+  macro->nargs = 0;
+  InitTable( macro->pieces );
+  macro->fingerprint = 0;
+  slot_MacroMap (map, map->macros.sz - 1);
+  return macro;
+}
+
+/** Find the macro named {name}, adding it with an empty value
+ * if there is none.
+ **/
+static
+  Macro*
+ensure_MacroMap (MacroMap* map, const char* name)
+{
+  const uint n = strlen (name);
+  const uint hash = hash_chars (name, n);
+  Macro* macro = find_hashed_MacroMap (map, name, n, hash);
+  if (macro)
+    return macro;
+  return add_MacroMap (map, cons1_AlphaTab (name), n, hash);
+}
+
+/** Write {n} bytes of finished HTML at {s} for an attribute value,
+ * which needs single quotes escaped too.
+ **/
+static
+  void
+oput_attr_html (OFile* of, const char* s, zuint n)
+{
+  zuint beg = 0;
+  for (zuint i = 0; i < n; ++i) {
+    if (s[i] == '\'') {
+      oputn_char_OFile (of, &s[beg], i - beg);
+      oput_cstr_OFile (of, entity_html (s[i], HtmlEscAttr));
+      beg = i + 1;
+    }
+  }
+  oputn_char_OFile (of, &s[beg], n - beg);
+}
+
+/** Set the value of {macro} to the finished HTML {html},
+ * with no arguments.
+ **/
+static
+  void
+set_html_Macro (Macro* macro, AlphaTab* html)
+{
+  const char* s;
+  lose_AlphaTab (&macro->html);
+  lose_AlphaTab (&macro->attr);
+  macro->html = *html;
+  *html = dflt_AlphaTab ();
+  s = ccstr_of_AlphaTab (&macro->html);
+  macro->html_sz = strlen (s);
+  macro->attr = dflt_AlphaTab ();
+  macro->attr_sz = 0;
+  macro->nargs = 0;
+  LoseTable( macro->pieces );
+  InitTable( macro->pieces );
+
+  if (strchr (s, '\'')) {
+    OFile of[] = default;
+    oput_attr_html (of, s, macro->html_sz);
+    init_AlphaTab_move_OFile (&macro->attr, of);
+    macro->attr_sz = strlen (ccstr_of_AlphaTab (&macro->attr));
+  }
+}
+
+/** 64-bit FNV-1a hash of the {n} bytes at {s}, continuing from {h}.**/
+static
+  uint64_t
+hash64_chars (uint64_t h, const void* s, zuint n)
+{
+  for (zuint i = 0; i < n; ++i) {
+    h ^= ((const byte*) s)[i];
+    h *= 1099511628211u;
+  }
+  return h;
+}
+
+/** Update the fingerprint of {map} after the value of {macro} changed.**/
+static
+  void
+fingerprint_MacroMap (MacroMap* map, Macro* macro)
+{
+  uint64_t h = 14695981039346656037u;
+  h = hash64_chars (h, ccstr_of_AlphaTab (&macro->name), macro->name_sz + 1);
+  h = hash64_chars (h, ccstr_of_AlphaTab (&macro->html), macro->html_sz + 1);
+  h = hash64_chars (h, &macro->nargs, sizeof (macro->nargs));
+  for (i ; macro->pieces.sz) {
+    const MacroPiece* piece = &macro->pieces.s[i];
+    h = hash64_chars (h, &piece->off, sizeof (piece->off));
+    h = hash64_chars (h, &piece->sz, sizeof (piece->sz));
+    h = hash64_chars (h, &piece->arg, sizeof (piece->arg));
+  }
+  map->fingerprint ^= macro->fingerprint;
+  macro->fingerprint = h;
+  map->fingerprint ^= macro->fingerprint;
+}
+
+/** Make {dst} hold copies of the macros in {src}.**/
+static
+  void
+copy_MacroMap (MacroMap* dst, const MacroMap* src)
+{
+  clear_MacroMap (dst);
+  for (i ; src->macros.sz) {
+    const Macro* from = &src->macros.s[i];
+    Macro* macro = ensure_MacroMap (dst, ccstr_of_AlphaTab (&from->name));
+    AlphaTab html = cons1_AlphaTab (ccstr_of_AlphaTab (&from->html));
+    set_html_Macro (macro, &html);
+    macro->nargs = from->nargs;
+    for (j ; from->pieces.sz)
+      *Grow1Table( macro->pieces ) = from->pieces.s[j];
+    fingerprint_MacroMap (dst, macro);
+  }
+}
+
+/** Time and size of one \input file, for -stats.**/
+typedef struct InputStats InputStats;
+struct InputStats
+{
+  AlphaTab path;
+  zuint sz;
+  double sec;
+  /** Whether its HTML came from the fragment cache.**/
+  bool cached;
+};
+DeclTableT( InputStats, InputStats );
+
+/** What converting one document cost, for -stats.**/
+typedef struct DocStats DocStats;
+struct DocStats
+{
+  zuint input_sz;
+  double head_sec;
+  double body_sec;
+  double foot_sec;
+  /** Whether the document came from the render cache.**/
+  bool cache_hit;
+  /** Uses of each command of htcmds[].**/
+  zuint* ncmds;
+  uint ncmds_sz;
+  zuint nmacro_hits;
+  zuint nmacro_misses;
+  /** Bytes given to the HTML escaping loop.**/
+  zuint escape_sz;
+  zuint peak_body_sz;
+  zuint peak_toc_sz;
+  zuint nallocs;
+  TableT(InputStats) inputs;
+};
+
+/** Whether {st} collects -stats.
+ * This is a constant false when they are not built in.
+ **/
+#define StatsOn(st)  (Tex2WebStats && (st) && (st)->stats)
+
+static
+  void
+clear_DocStats (DocStats* ds)
+{
+  ds->input_sz = 0;
+  ds->head_sec = 0;
+  ds->body_sec = 0;
+  ds->foot_sec = 0;
+  ds->cache_hit = false;
+  memset (ds->ncmds, 0, ds->ncmds_sz * sizeof (zuint));
+  ds->nmacro_hits = 0;
+  ds->nmacro_misses = 0;
+  ds->escape_sz = 0;
+  ds->peak_body_sz = 0;
+  ds->peak_toc_sz = 0;
+  ds->nallocs = 0;
+  for (i ; ds->inputs.sz)
+    lose_AlphaTab (&ds->inputs.s[i].path);
+  ds->inputs.sz = 0;
+}
+
+static
+  void
+init_DocStats (DocStats* ds, uint ncmds)
+{
+  ds->ncmds = AllocT( zuint, ncmds );
+  ds->ncmds_sz = ncmds;
+  InitTable( ds->inputs );
+  clear_DocStats (ds);
+}
+
+static
+  void
+lose_DocStats (DocStats* ds)
+{
+  clear_DocStats (ds);
+  LoseTable( ds->inputs );
+  free (ds->ncmds);
+}
+
+typedef struct HtCmd HtCmd;
+
+/** Kinds of nodes in the document IR.**/
+enum IrKind
+{
+  IrNone,
+  IrDocument,
+  IrParagraph,
+  IrList,
+  IrItem,
+  IrSection,
+  IrSubsection,
+  IrTable,
+  IrRow,
+  IrCell,
+  IrCode,
+  IrInlineCode,
+  IrAlign,
+  IrLink,
+  IrImage,
+  IrMath,
+  IrCommand,
+  IrLabel,
+  IrDash,
+  IrMacro,
+  IrInput,
+  IrText,
+  NIrKinds
+};
+
+static const char* const ir_kind_names[NIrKinds] =
+{
+  "none", "document", "paragraph", "list", "item",
+  "section", "subsection", "table", "row", "cell", "code", "inline_code",
+  "align", "link", "image", "math", "command", "label", "dash",
+  "macro", "input", "text"
+};
+
+/** Flags of an IR node that change how its HTML is written.**/
+enum IrFlag
+{
+  /** A paragraph, list or code block that follows text closely.**/
+  IrCram = 1 << 0,
+  /** A link from \texthref, which is not colored.**/
+  IrBlack = 1 << 1,
+  /** A link from \url, whose target is in single quotes.**/
+  IrQuote = 1 << 2,
+  /** A table row with a line above it.**/
+  IrHline = 1 << 3,
+  /** A section after subsections, which ends their list
+   * in the table of contents.
+   **/
+  IrEndSubs = 1 << 4
+};
+
+/** Offset of a span that is not in any input file.**/
+#define IrNoPos  (~(zuint) 0)
+
+/** A node of the document IR.
+ *
+ * The parser fills one in for each construct and hands it to
+ * open_IrNode() and close_IrNode(), which write its HTML.
+ * Only nodes that are recorded are kept, in {Ir.arena}.
+ **/
+typedef struct IrNode IrNode;
+struct IrNode
+{
+  uint kind;
+  /** Flags from IrFlag.**/
+  uint flags;
+  /** Index into {Ir.files} of the file that {beg} and {end} point into.**/
+  uint file;
+  zuint beg;
+  zuint end;
+  /** Label of a section, target of a link, name of a macro or command,
+   * tag of a list, column spec of a table, or path of a file.
+   **/
+  const char* attr;
+  /** Section and subsection numbers, the column style of a cell,
+   * the number of hyphens in a dash,
+   * or where the second part of a \caturl target starts in {attr}.
+   **/
+  uint num[2];
+  /** Command whose tags are written, for IrCommand and IrInlineCode.**/
+  const HtCmd* cmd;
+  /** Where the parser's node is recorded, if it is.**/
+  IrNode* kept;
+  IrNode* parent;
+  IrNode* child;
+  IrNode* last;
+  IrNode* next;
+};
+
+/** Text that spans are measured in, and its offset in its file.**/
+typedef struct IrSrc IrSrc;
+struct IrSrc
+{
+  const char* base;
+  zuint base_sz;
+  zuint shift;
+  uint file;
+};
+
+/** Structure of a document, recorded while it is converted,
+ * with spans into its input files.
+ **/
+typedef struct Ir Ir;
+struct Ir
+{
+  Arena arena[1];
+  IrNode* root;
+  /** Node that new nodes go into, or null while nothing is recorded.**/
+  IrNode* cur;
+  /** Name of the document itself, which is file 0.**/
+  const char* name;
+  /** Files that spans point into, from {arena}.**/
+  TableT(AlphaTab) files;
+  IrSrc src;
+};
+
+static
+  void
+init_Ir (Ir* ir)
+{
+  init_Arena (ir->arena);
+  ir->root = 0;
+  ir->cur = 0;
+  ir->name = 0;
+  InitTable( ir->files );
+  ir->src.base = 0;
+  ir->src.base_sz = 0;
+  ir->src.shift = 0;
+  ir->src.file = 0;
+}
+
+static
+  void
+lose_Ir (Ir* ir)
+{
+  lose_Arena (ir->arena);
+  LoseTable( ir->files );
+}
+
+/** Start a node of {kind} that has no span, attribute or children yet.**/
+static
+  void
+init_IrNode (IrNode* node, uint kind)
+{
+  node->kind = kind;
+  node->flags = 0;
+  node->file = 0;
+  node->beg = IrNoPos;
+  node->end = IrNoPos;
+  node->attr = 0;
+  node->num[0] = 0;
+  node->num[1] = 0;
+  node->cmd = 0;
+  node->kept = 0;
+  node->parent = 0;
+  node->child = 0;
+  node->last = 0;
+  node->next = 0;
+}
+
+/** Offset of {p} in the current file, if it is in the current text.**/
+static
+  zuint
+pos_Ir (const Ir* ir, const char* p)
+{
+  const IrSrc* src = &ir->src;
+  if (!p || !src->base || p < src->base || p > &src->base[src->base_sz])
+    return IrNoPos;
+  return (zuint) (p - src->base) + src->shift;
+}
+
+/** Index of the file named {path}, which is added if it is new.**/
+static
+  uint
+file_Ir (Ir* ir, const char* path)
+{
+  for (i ; ir->files.sz) {
+    if (eq_cstr (path, ccstr_of_AlphaTab (&ir->files.s[i])))
+      return i;
+  }
+  *Grow1Table( ir->files ) =
+    dflt1_AlphaTab (dup_Arena (ir->arena, path, strlen (path)));
+  return ir->files.sz - 1;
+}
+
+/** Measure spans in {text}, which is a copy of the current text at {orig},
+ * or in a new file named {path} when {orig} is null.
+ **/
+static
+  void
+retarget_Ir (Ir* ir, const char* text, const char* orig, const char* path)
+{
+  const zuint shift = pos_Ir (ir, orig);
+  ir->src.shift = (orig ? shift : 0);
+  if (path) {
+    ir->src.file = file_Ir (ir, path);
+  }
+  else if (shift == IrNoPos) {
+    text = 0;
+  }
+  ir->src.base = text;
+  ir->src.base_sz = (text ? strlen (text) : 0);
+}
+
+/** Start the IR of a document whose whole text is {text}.
+ * Nothing is recorded until {ir->cur} is set to {ir->root}.
+ **/
+static
+  void
+begin_Ir (Ir* ir, const char* text)
+{
+  IrNode* root;
+  reset_Arena (ir->arena);
+  ir->files.sz = 0;
+  retarget_Ir (ir, text, 0, ir->name ? ir->name : "-");
+  root = (IrNode*) take_Arena (ir->arena, sizeof (IrNode));
+  init_IrNode (root, IrDocument);
+  root->beg = 0;
+  root->end = ir->src.base_sz;
+  ir->root = root;
+  ir->cur = 0;
+}
+
+/** Copy the nodes under {from}, which is in {src},
+ * to the end of the nodes under {to} in {ir}.
+ * The index in {ir} of each file of {src} is put in {files}
+ * when a node first uses it.
+ **/
+static
+  void
+graft_IrNode (Ir* ir, IrNode* to, const Ir* src, const IrNode* from,
+              uint* files)
+{
+  for (const IrNode* x = from->child; x; x = x->next) {
+    IrNode* y = (IrNode*) take_Arena (ir->arena, sizeof (IrNode));
+    if (files[x->file] == UINT_MAX)
+      files[x->file] =
+        file_Ir (ir, ccstr_of_AlphaTab (&src->files.s[x->file]));
+    *y = *x;
+    y->file = files[x->file];
+    if (x->attr)
+      y->attr = dup_Arena (ir->arena, x->attr, strlen (x->attr));
+    y->kept = 0;
+    y->parent = to;
+    y->child = 0;
+    y->last = 0;
+    y->next = 0;
+    if (to->last)
+      to->last->next = y;
+    else
+      to->child = y;
+    to->last = y;
+    graft_IrNode (ir, y, src, x, files);
+  }
+}
+
+/** Copy the nodes under {from}, which is in {src},
+ * to the end of the nodes under {to} in {ir}.
+ * Files are matched by name.
+ **/
+static
+  void
+graft_Ir (Ir* ir, IrNode* to, const Ir* src, const IrNode* from)
+{
+  uint* files = AllocT( uint, src->files.sz + 1 );
+  for (i ; src->files.sz)
+    files[i] = UINT_MAX;
+  graft_IrNode (ir, to, src, from, files);
+  free (files);
+}
+
+typedef struct FileDep FileDep;
+typedef struct FragState FragState;
+typedef struct Fragment Fragment;
+
+/** A file that the conversion read.**/
+struct FileDep
+{
+  AlphaTab path;
+  /** Modification time and size when it was read.**/
+  struct timespec mtime;
+  zuint sz;
+  /** Hash of the content, kept only for the render cache.**/
+  uint64_t hash;
+  /** The file was looked for at {path} and not found.**/
+  bool absent;
+};
+DeclTableT( FileDep, FileDep );
+
+/** The parts of HtmlState that change how text is rendered,
+ * or that an \input file changes for the text after it.
+ **/
+struct FragState
+{
+  bool eol;
+  bool inparagraph;
+  bool end_document;
+  uint list_depth;
+  bool list_item_open;
+  Bool cram;
+  uint nsections;
+  uint nsubsections;
+};
+
+/** The rendered HTML of an \input file.
+ *
+ * It can stand in for the file when the file and everything it read
+ * are unchanged, the macros are the same, and the state {beg} matches.
+ * The section counters in {beg} only matter when the file has sections
+ * or writes their numbers, as \label does.
+ **/
+struct Fragment
+{
+  AlphaTab path;
+  uint64_t macros;
+  FragState beg;
+  FragState end;
+  bool sections;
+  AlphaTab html;
+  zuint html_sz;
+  /** Text that the file added to the table of contents.**/
+  AlphaTab toc;
+  zuint toc_sz;
+  /** The file itself and all files that it read.**/
+  TableT(FileDep) deps;
+  /** Nodes that the file added to the IR, when the IR is recorded.**/
+  Ir* ir;
+};
+DeclTableT( Fragment, Fragment );
+
+/** Where the lines of a listing file start.**/
+typedef struct LineIndex LineIndex;
+struct LineIndex
+{
+  /** The file as it was when it was indexed.**/
+  FileDep file;
+  /** Offset of each line, and then the size of the file.**/
+  TableT(zuint) offs;
+};
+DeclTableT( LineIndex, LineIndex );
+
+typedef struct HtmlState HtmlState;
+
+/** Number of slots in the command dispatch index. Must be a power of 2.**/
+#define NHtCmdSlots 128
+
+static bool
+htbody (OFile* of, XFile* xf, HtmlState* st);
+
+struct HtmlState
+{
+  bool allgood;
+  zuint nlines;
+  bool eol;
+  bool inparagraph;
+  bool end_document;
+  uint list_depth;
+  bool list_item_open;
+  Bool cram;
+  bool show_toc;
+  zuint toc_pos;
+  /** Where the converted document goes.**/
+  OSink* sink;
+  OFile* errfile;
+  uint nsections;
+  uint nsubsections;
+  /** Times that the section counters were written into the HTML,
+   * so an \input file can tell whether its HTML depends on them.
+   **/
+  uint nsection_uses;
+  /** Escaped head fields, which point into {arena}.**/
+  AlphaTab pagetitle;
+  AlphaTab title;
+  AlphaTab author;
+  AlphaTab date;
+  /** Temporary strings of the document, released by reset_HtmlState().**/
+  Arena arena[1];
+  /** Where head fields are escaped before they are copied to {arena}.**/
+  OFile tmp_ofile[1];
+  /** Head of the document until it is written along with the body.**/
+  OFile head_ofile[1];
+  OFile toc_ofile[1];
+  OFile body_ofile[1];
+  /** Body text after the table of contents that was moved out of
+   * {body_ofile} before the table was done, or null.
+   **/
+  FILE* spill;
+  const char* pathname;
+  /** Index of the text being parsed, if any.**/
+  const TexIndex* index;
+  TableT(AlphaTab) search_paths;
+  MacroMap macros;
+  /** Preamble snapshot that the names and values of macros point into.**/
+  void* preamble_map;
+  zuint preamble_map_sz;
+  /** Number of htbody() calls and macro expansions in progress.**/
+  uint body_depth;
+  /** Lowest stack address that nesting may reach in the thread
+   * that is parsing, or null to bound {body_depth} by MaxBodyDepth.
+   **/
+  uintptr_t stack_limit;
+  /** Files read by the document so far.**/
+  TableT(FileDep) deps;
+  /** Rendered \input files, kept from one document to the next.**/
+  TableT(Fragment) fragments;
+  /** Lines of listing files that were cut, also kept.**/
+  TableT(LineIndex) line_indexes;
+  /** While nonzero, the body is not flushed.**/
+  uint hold_flush;
+  /** Number of \input files being converted whose HTML may be kept.
+   * They hold the body from offset {frag_hold_beg} on.
+   **/
+  uint frag_holds;
+  zuint frag_hold_beg;
+  /** Times that such files were given up on to flush the body.**/
+  uint frag_drops;
+  /** Number of problems reported by htbog().**/
+  uint nbogs;
+  /** Where \input and \codeinputlisting files come from,
+   * or null to read them from the file system.
+   **/
+  Tex2WebIncludeFn include;
+  void* include_arg;
+  /** Directory of the render cache, or null.**/
+  const char* cache_dir;
+  /** Entry of the render cache that everything written to {sink}
+   * also goes to, or null.
+   **/
+  RCacheWriter* cache_writer;
+  /** Counts for -stats, or null.**/
+  DocStats* stats;
+  /** Threads that the sections of one document can be rendered on.**/
+  uint nthreads;
+  /** Document IR to record, or null.**/
+  Ir* ir;
+  /** Backslash of the command being handled.**/
+  const char* cmd_beg;
+  AlphaTab css_filepath;
+  byte htcmd_slots[NHtCmdSlots];
+};
+
+static void
+init_htcmd_slots (byte* slots);
+
+static
+  void
+init_HtmlState (HtmlState* st, OSink* sink)
+{
+  st->allgood = true;
+  st->nlines = 1;
+  st->eol = true;
+  st->inparagraph = false;
+  st->end_document = false;
+  st->list_depth = 0;
+  st->list_item_open = false;
+  st->cram = false;
+  st->show_toc = false;
+  st->toc_pos = 0;
+  st->sink = sink;
+  st->errfile = stderr_OFile ();
+  st->nsections = 0;
+  st->nsubsections = 0;
+  st->nsection_uses = 0;
+  st->pagetitle = dflt_AlphaTab ();
+  st->title = dflt_AlphaTab ();
+  st->author = dflt_AlphaTab ();
+  st->date = dflt_AlphaTab ();
+  init_Arena (st->arena);
+  init_OFile (st->tmp_ofile);
+  init_OFile (st->head_ofile);
+  init_OFile (st->toc_ofile);
+  init_OFile (st->body_ofile);
+  st->spill = 0;
+  st->pathname = 0;
+  st->index = 0;
+  InitTable( st->search_paths );
+  init_MacroMap (&st->macros);
+  st->preamble_map = 0;
+  st->preamble_map_sz = 0;
+  st->body_depth = 0;
+  st->stack_limit = 0;
+  InitTable( st->deps );
+  InitTable( st->fragments );
+  InitTable( st->line_indexes );
+  st->hold_flush = 0;
+  st->frag_holds = 0;
+  st->frag_hold_beg = 0;
+  st->frag_drops = 0;
+  st->nbogs = 0;
+  st->include = 0;
+  st->include_arg = 0;
+  st->cache_dir = 0;
+  st->cache_writer = 0;
+  st->stats = 0;
+  st->nthreads = 1;
+  st->ir = 0;
+  st->cmd_beg = 0;
+  st->css_filepath = dflt_AlphaTab ();
+  init_htcmd_slots (st->htcmd_slots);
+}
+
+static
+  void
+clear_deps_HtmlState (HtmlState* st)
+{
+  for (i ; st->deps.sz)
+    lose_AlphaTab (&st->deps.s[i].path);
+  st->deps.sz = 0;
+}
+
+/** Fill {dep} for the file {filename} in the directory {dir}.
+ * This fails when there is no such file.
+ **/
+static
+  bool
+stat_FileDep (FileDep* dep, const char* dir, const char* filename,
+              bool* ret_regular)
+{
+  struct stat sb;
+  dep->path = dflt_AlphaTab ();
+  cat_filepath_AlphaTab (&dep->path, dir, filename);
+  if (0 != stat (ccstr_of_AlphaTab (&dep->path), &sb)) {
+    lose_AlphaTab (&dep->path);
+    return false;
+  }
+  dep->mtime = sb.st_mtim;
+  dep->sz = (zuint) sb.st_size;
+  dep->hash = 0;
+  dep->absent = false;
+  if (ret_regular)
+    *ret_regular = S_ISREG(sb.st_mode);
+  return true;
+}
+
+/** Check that the file of {dep} has not changed since it was read,
+ * or that there is still no file when it was not found.
+ **/
+static
+  bool
+fresh_FileDep (const FileDep* dep)
+{
+  struct stat sb;
+  if (dep->absent)
+    return (0 != stat (ccstr_of_AlphaTab (&dep->path), &sb));
+  return (0 == stat (ccstr_of_AlphaTab (&dep->path), &sb) &&
+          sb.st_mtim.tv_sec == dep->mtime.tv_sec &&
+          sb.st_mtim.tv_nsec == dep->mtime.tv_nsec &&
+          (zuint) sb.st_size == dep->sz);
+}
+
+static
+  void
+push_FileDep (TableT(FileDep)* deps, const FileDep* dep)
+{
+  FileDep* copy = Grow1Table( *deps );
+  copy->path = cons1_AlphaTab (ccstr_of_AlphaTab (&dep->path));
+  copy->mtime = dep->mtime;
+  copy->sz = dep->sz;
+  copy->hash = dep->hash;
+  copy->absent = dep->absent;
+}
+
+/** Hash the {text} of a file that the document read,
+ * which is only needed for the render cache.
+ **/
+static
+  uint64_t
+text_hash_HtmlState (const HtmlState* st, const char* text)
+{
+  if (!st->cache_dir)
+    return 0;
+  return hash_RCache (0, text, strlen (text));
+}
+
+/** Note that the document read the file {filename} in {dir},
+ * whose content is {text}.
+ **/
+static
+  void
+add_dep_HtmlState (HtmlState* st, const char* dir, const char* filename,
+                   const char* text)
+{
+  FileDep dep[1];
+  if (stat_FileDep (dep, dir, filename, 0)) {
+    dep->hash = text_hash_HtmlState (st, text);
+    push_FileDep (&st->deps, dep);
+    lose_AlphaTab (&dep->path);
+  }
+}
+
+/** Note that the document looked for {filename} in {dir} and found
+ * nothing there, since a file that appears there later would be read
+ * in place of the one that was.
+ **/
+static
+  void
+add_absent_dep_HtmlState (HtmlState* st, const char* dir,
+                          const char* filename)
+{
+  FileDep* dep = Grow1Table( st->deps );
+  dep->path = dflt_AlphaTab ();
+  cat_filepath_AlphaTab (&dep->path, dir, filename);
+  dep->mtime.tv_sec = 0;
+  dep->mtime.tv_nsec = 0;
+  dep->sz = 0;
+  dep->hash = 0;
+  dep->absent = true;
+}
+
+static
+  void
+lose_Fragment (Fragment* frag)
+{
+  lose_AlphaTab (&frag->path);
+  lose_AlphaTab (&frag->html);
+  lose_AlphaTab (&frag->toc);
+  for (i ; frag->deps.sz)
+    lose_AlphaTab (&frag->deps.s[i].path);
+  LoseTable( frag->deps );
+  if (frag->ir) {
+    lose_Ir (frag->ir);
+    free (frag->ir);
+  }
+}
+
+static
+  void
+lose_HtmlState (HtmlState* st)
+{
+  lose_Arena (st->arena);
+  lose_OFile (st->tmp_ofile);
+  lose_OFile (st->head_ofile);
+  lose_OFile (st->toc_ofile);
+  lose_OFile (st->body_ofile);
+  if (st->spill)
+    fclose (st->spill);
+  for (i ; st->search_paths.sz)
+    lose_AlphaTab (&st->search_paths.s[i]);
+  LoseTable( st->search_paths );
+
+  lose_MacroMap (&st->macros);
+  if (st->preamble_map)
+    munmap (st->preamble_map, st->preamble_map_sz);
+  clear_deps_HtmlState (st);
+  LoseTable( st->deps );
+  for (i ; st->fragments.sz)
+    lose_Fragment (&st->fragments.s[i]);
+  LoseTable( st->fragments );
+  for (i ; st->line_indexes.sz) {
+    lose_AlphaTab (&st->line_indexes.s[i].file.path);
+    LoseTable( st->line_indexes.s[i].offs );
+  }
+  LoseTable( st->line_indexes );
+  lose_AlphaTab (&st->css_filepath);
+}
+
+/** Prepare {st} for another document.
+ *
+ * Everything that one document sets up is cleared.
+ * Macros and the CSS path are restored from {proto},
+ * which holds the options given on the command line.
+ * Search paths are left alone since documents cannot change them,
+ * and cached \input files stay valid for as long as their files do.
+ **/
+static
+  void
+reset_HtmlState (HtmlState* st, HtmlState* proto, OSink* sink)
+{
+  st->allgood = true;
+  st->nlines = 1;
+  st->eol = true;
+  st->inparagraph = false;
+  st->end_document = false;
+  st->list_depth = 0;
+  st->list_item_open = false;
+  st->cram = false;
+  st->show_toc = false;
+  st->toc_pos = 0;
+  st->sink = sink;
+  st->nsections = 0;
+  st->nsubsections = 0;
+  st->nsection_uses = 0;
+  st->pagetitle = dflt_AlphaTab ();
+  st->title = dflt_AlphaTab ();
+  st->author = dflt_AlphaTab ();
+  st->date = dflt_AlphaTab ();
+  reset_Arena (st->arena);
+  lose_OFile (st->tmp_ofile);
+  lose_OFile (st->head_ofile);
+  lose_OFile (st->toc_ofile);
+  lose_OFile (st->body_ofile);
+  init_OFile (st->tmp_ofile);
+  init_OFile (st->head_ofile);
+  init_OFile (st->toc_ofile);
+  init_OFile (st->body_ofile);
+  if (st->spill)
+    fclose (st->spill);
+  st->spill = 0;
+  st->pathname = 0;
+  st->index = 0;
+
+  copy_MacroMap (&st->macros, &proto->macros);
+  st->body_depth = 0;
+  st->stack_limit = 0;
+  clear_deps_HtmlState (st);
+  st->hold_flush = 0;
+  st->frag_holds = 0;
+  st->frag_hold_beg = 0;
+  st->frag_drops = 0;
+  st->nbogs = 0;
+  st->cache_writer = 0;
+  if (st->stats)
+    clear_DocStats (st->stats);
+  copy_AlphaTab (&st->css_filepath, &proto->css_filepath);
+}
+
+/** Give a new state {st} the options of {proto}
+ * that reset_HtmlState() does not copy,
+ * so that it can convert documents on another thread.
+ **/
+static
+  void
+init_worker_HtmlState (HtmlState* st, const HtmlState* proto)
+{
+  init_HtmlState (st, 0);
+  st->cache_dir = proto->cache_dir;
+  st->include = proto->include;
+  st->include_arg = proto->include_arg;
+  for (i ; proto->search_paths.sz) {
+    const AlphaTab* path = &proto->search_paths.s[i];
+    *Grow1Table( st->search_paths ) =
+      cons1_AlphaTab (ccstr_of_AlphaTab (path));
+  }
+}
+
+/** Whether {st} is recording IR nodes right now.**/
+#define IrOn(st)  ((st)->ir && (st)->ir->cur)
+
+/** Record a copy of {node} that starts at {beg} in the node being
+ * recorded, and make it the node that new nodes go into.
+ **/
+static
+  IrNode*
+record_IrNode (HtmlState* st, const IrNode* node, const char* beg)
+{
+  Ir* ir = st->ir;
+  IrNode* x;
+  if (!IrOn(st))
+    return 0;
+  x = (IrNode*) take_Arena (ir->arena, sizeof (IrNode));
+  *x = *node;
+  x->file = ir->src.file;
+  x->beg = pos_Ir (ir, beg);
+  x->end = IrNoPos;
+  if (node->attr)
+    x->attr = dup_Arena (ir->arena, node->attr, strlen (node->attr));
+  x->kept = 0;
+  x->parent = ir->cur;
+  x->child = 0;
+  x->last = 0;
+  x->next = 0;
+  if (ir->cur->last)
+    ir->cur->last->next = x;
+  else
+    ir->cur->child = x;
+  ir->cur->last = x;
+  ir->cur = x;
+  return x;
+}
+
+/** End the recorded {node} at {end}, along with any nodes still open
+ * inside it.
+ **/
+static
+  void
+end_IrNode (HtmlState* st, IrNode* node, const char* end)
+{
+  Ir* ir = st->ir;
+  IrNode* x;
+  if (!node || !IrOn(st))
+    return;
+  for (x = ir->cur; x && x != node; x = x->parent) {}
+  if (!x) {
+    /* It was already ended with one of its parents.*/
+    return;
+  }
+  for (x = ir->cur; x != node->parent; x = x->parent) {
+    if (x->file == ir->src.file && x->end == IrNoPos)
+      x->end = pos_Ir (ir, end);
+  }
+  ir->cur = node->parent;
+}
+
+/** Nearest open node of {kind} that is recorded.**/
+static
+  IrNode*
+find_IrNode (HtmlState* st, uint kind)
+{
+  IrNode* x;
+  if (!IrOn(st))
+    return 0;
+  for (x = st->ir->cur; x; x = x->parent)
+    if (x->kind == kind)
+      return x;
+  return 0;
+}
+
+/** Stop recording, for text that is not part of the document in order.**/
+static
+  IrNode*
+pause_Ir (HtmlState* st)
+{
+  IrNode* cur = (st->ir ? st->ir->cur : 0);
+  if (st->ir)
+    st->ir->cur = 0;
+  return cur;
+}
+
+static
+  void
+resume_Ir (HtmlState* st, IrNode* cur)
+{
+  if (st->ir)
+    st->ir->cur = cur;
+}
+
+/** Measure spans as retarget_Ir() does, until leave_Ir() is given
+ * what this returns.
+ **/
+static
+  IrSrc
+enter_Ir (HtmlState* st, const char* text, const char* orig,
+          const char* path)
+{
+  IrSrc src = { 0, 0, 0, 0 };
+  if (st->ir) {
+    src = st->ir->src;
+    retarget_Ir (st->ir, text, orig, path);
+  }
+  return src;
+}
+
+static
+  void
+leave_Ir (HtmlState* st, const IrSrc* src)
+{
+  if (st->ir)
+    st->ir->src = *src;
+}
+
+static void
+oput_open_IrNode (OFile* of, HtmlState* st, const IrNode* node);
+static void
+oput_close_IrNode (OFile* of, HtmlState* st, const IrNode* node);
+static void
+oput_toc_open_IrNode (OFile* toc, const IrNode* node);
+static void
+oput_toc_close_IrNode (OFile* toc, const IrNode* node);
+static void
+escape_html_XFile (OFile* of, XFile* xf, HtmlState* st, HtmlEscMode mode);
+
+/** Open {node}, which starts at {beg}.
+ * Its HTML is written to {of}, and it is recorded when the IR is.
+ **/
+static
+  void
+open_IrNode (OFile* of, HtmlState* st, IrNode* node, const char* beg)
+{
+  node->kept = record_IrNode (st, node, beg);
+  oput_open_IrNode (of, st, node);
+}
+
+/** Close {node}, which ends at {end}.**/
+static
+  void
+close_IrNode (OFile* of, HtmlState* st, IrNode* node, const char* end)
+{
+  oput_close_IrNode (of, st, node);
+  end_IrNode (st, node->kept, end);
+}
+
+/** Open and close {node}, which spans {beg} to {end}
+ * and has nothing inside it.
+ **/
+static
+  void
+put_IrNode (OFile* of, HtmlState* st, IrNode* node,
+            const char* beg, const char* end)
+{
+  open_IrNode (of, st, node, beg);
+  close_IrNode (of, st, node, end);
+}
+
+/** Write the text of {xf} as a text node, escaped for HTML.
+ * Its macros are expanded unless it is {verbatim}.
+ **/
+static
+  void
+put_text_IrNode (OFile* of, HtmlState* st, XFile* xf, bool verbatim)
+{
+  IrNode node[1];
+  const char* s = ccstr_of_XFile (xf);
+  init_IrNode (node, IrText);
+  node->kept = record_IrNode (st, node, s);
+  if (node->kept && node->kept->beg != IrNoPos)
+    node->kept->end = node->kept->beg + strlen (s);
+  escape_html_XFile (of, xf, verbatim ? 0 : st, HtmlEscText);
+  end_IrNode (st, node->kept, 0);
+}
+
+#define W(s)  oput_cstr_OFile (ofile, s)
+static
+  void
+css_html (OFile* ofile)
+{
+  W("\npre {");
+  W("\n  padding-left: 3em;");
+  W("\n  white-space: pre-wrap;");
+  //W("\n  white-space: -moz-pre-wrap;");
+  //W("\n  white-space: -o-pre-wrap;");
+  W("\n  display: block;");
+  W("\n}");
+  W("\npre.cram, ol.cram, ul.cram {");
+  W("\n  margin-top: -1em;");
+  W("\n}");
+  W("\np.cram { margin-top: -0.5em; }");
+  W("\nspan.underline { text-decoration: underline; }");
+  W("\nspan.texttt, span.ttvbl {");
+  W("\n  font-family:\"Courier New\", Monospace;");
+  W("\n}");
+  //W("\npre.shortb {");
+  //W("\n  margin-bottom: -1em;");
+  //W("\n}");
+  W("\npre, code {");
+  W("\n  background-color: #E2E2E2;");
+  W("\n}");
+  W("\na.texturl:link, a.texturl:visited {");
+  W("\n  color: black;");
+  W("\n  text-decoration: none;");
+  W("\n}");
+  W("\na.texturl:hover {");
+  W("\n  color: blue;");
+  W("\n  text-decoration: underline;");
+  W("\n}");
+  W("\ntable {");
+  W("\n  border-spacing: 0;");
+  W("\n  border-collapse: collapse;");
+  W("\n}");
+  W("\ntd {");
+  W("\n  padding: 0.3em;");
+  W("\n  text-align: left;");
+  W("\n}");
+  W("\n.ljust { text-align: left; }");
+  W("\n.cjust { text-align: center; }");
+  W("\n.rjust { text-align: right; }");
+  W("\ntd.lline { border-left: thin solid black; }");
+  W("\ntd.rline { border-right: thin solid black; }");
+  W("\ntr.hline { border-top: thin solid black; }");
+}
+
+static
+  void
+head_html (HtmlState* st)
+{
+  OFile* ofile = st->head_ofile;
+  //W("<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Transitional//EN\" \"http://www.w3.org/TR/xhtml1/DTD/xhtml1-transitional.dtd\">");
+  //W("<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML Basic 1.0//EN\" \"http://www.w3.org/TR/xhtml-basic/xhtml-basic10.dtd\">");
+  W("<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML-Print 1.0//EN\" \"http://www.w3.org/MarkUp/DTD/xhtml-print10.dtd\">");
+  W("\n<html xmlns=\"http://www.w3.org/1999/xhtml\">");
+  W("\n<head>");
+  W("\n<meta http-equiv=\"Content-Type\" content=\"text/html;charset=utf-8\" />");
+
+  if (empty_ck_AlphaTab (&st->css_filepath)) {
+    //W("<style media=\"screen\" type=\"text/css\">\n");
+    W("\n<style type=\"text/css\">");
+    css_html (ofile);
+    W("\n</style>");
+  }
+  else {
+    W("\n<link rel=\"stylesheet\" type=\"text/css\" href=\"");
+    W(ccstr_of_AlphaTab (&st->css_filepath));
+    W("\">");
+  }
+
+  W("\n<title>"); oput_AlphaTab (ofile, &st->pagetitle); W("</title>");
+  W("\n</head>");
+  W("\n<body>");
+
+  W("\n<div class=\"cjust\">");
+  W("\n<h1>"); oput_AlphaTab (ofile, &st->title); W("</h1>");
+  if (!empty_ck_AlphaTab(&st->author)) {
+    W("\n<div>by "); oput_AlphaTab (ofile, &st->author); W("</div>");
+  }
+  if (!empty_ck_AlphaTab(&st->date)) {
+    W("\n<div>"); oput_AlphaTab (ofile, &st->date); W("</div>");
+  }
+  W("\n</div>");
+}
+
+/** Add {of}'s text from {beg} to {end} to {segs}, which hold {n} segments.**/
+static inline
+  uint
+seg_OFile (struct iovec* segs, uint n, OFile* of, zuint beg, zuint end)
+{
+  if (beg < end) {
+    AlphaTab ab = window2_OFile (of, beg, end);
+    segs[n].iov_base = ab.s;
+    segs[n].iov_len = end - beg;
+    ++ n;
+  }
+  return n;
+}
+
+/** Add {s} to {segs}, which hold {n} segments.**/
+static inline
+  uint
+seg_cstr (struct iovec* segs, uint n, const char* s)
+{
+  segs[n].iov_base = (char*) s;
+  segs[n].iov_len = strlen (s);
+  return n + 1;
+}
+
+/** Write {segs} to {st->sink} in one go.
+ * The first slot of {segs} is reserved for the head,
+ * which is written along with the first text of the body.
+ **/
+static
+  void
+emit_HtmlState (HtmlState* st, struct iovec* segs, uint nsegs)
+{
+  OFile* head = st->head_ofile;
+  segs[0].iov_base = 0;
+  segs[0].iov_len = 0;
+  seg_OFile (segs, 0, head, 0, head->off);
+  writev_OSink (st->sink, segs, nsegs);
+  if (st->cache_writer)
+    writev_RCacheWriter (st->cache_writer, segs, nsegs);
+  if (head->off > 0) {
+    lose_OFile (head);
+    init_OFile (head);
+  }
+}
+
+/** Move the body text in {st->spill} over to {st->sink}.**/
+static
+  void
+drain_spill_HtmlState (HtmlState* st)
+{
+  char buf[1 << 16];
+  struct iovec segs[2];
+  zuint n;
+  if (!st->spill)  return;
+  rewind (st->spill);
+  while (0 < (n = fread (buf, 1, sizeof (buf), st->spill))) {
+    segs[1].iov_base = buf;
+    segs[1].iov_len = n;
+    emit_HtmlState (st, segs, 2);
+  }
+  fclose (st->spill);
+  st->spill = 0;
+}
+
+/** Note the sizes of the body and table of contents buffers.**/
+static inline
+  void
+peak_stats_HtmlState (HtmlState* st)
+{
+  if (StatsOn(st)) {
+    DocStats* ds = st->stats;
+    if (ds->peak_body_sz < st->body_ofile->off)
+      ds->peak_body_sz = st->body_ofile->off;
+    if (ds->peak_toc_sz < st->toc_ofile->off)
+      ds->peak_toc_sz = st->toc_ofile->off;
+  }
+}
+
+/** Write the rest of the document.
+ * Unless part of the body was spilled, this is a single write
+ * of the head, the body before the table of contents,
+ * the table itself, and the body after it.
+ **/
+static
+  void
+foot_html (HtmlState* st)
+{
+  OFile* body = st->body_ofile;
+  struct iovec segs[8];
+  uint n = 1;
+
+  peak_stats_HtmlState (st);
+
+  n = seg_OFile (segs, n, body, 0, st->toc_pos);
+  if (st->show_toc) {
+    n = seg_cstr (segs, n, "<p>Contents</p>");
+    n = seg_OFile (segs, n, st->toc_ofile, 0, st->toc_ofile->off);
+    if (st->nsubsections > 0)
+      n = seg_cstr (segs, n, "</li></ol>");
+    n = seg_cstr (segs, n, "</li></ol>");
+  }
+
+  if (st->spill) {
+    emit_HtmlState (st, segs, n);
+    drain_spill_HtmlState (st);
+    n = 1;
+  }
+  n = seg_OFile (segs, n, body, st->toc_pos, body->off);
+
+  //W("<p><a href=\"http://validator.w3.org/check?uri=referer\">Valid XHTML-Print 1.0</a></p>\n");
+  n = seg_cstr (segs, n, "\n</body>\n</html>\n");
+  emit_HtmlState (st, segs, n);
+}
+#undef W
+
+/** Report a problem with the document being converted.
+ * Messages go to {st->errfile} so that concurrent conversions
+ * do not share an output stream.
+ **/
+static
+  void
+htbog (HtmlState* st, const char* msg, const char* arg)
+{
+  OFile* of = st->errfile;
+  st->nbogs += 1;
+  oput_cstr_OFile (of, msg);
+  if (arg)
+    oput_cstr_OFile (of, arg);
+  oput_char_OFile (of, '\n');
+}
+
+/** Like DoLegitLine() and DoLegitLineP(), but a failure is reported
+ * through htbog() to {st->errfile} along with the other problems
+ * of the document, not to the process's stderr.
+ **/
+#define HtLegitLine( st, msg ) \
+  for (bool ht_legit_ = good; ht_legit_; \
+       ht_legit_ = false, good ? (void) 0 : htbog (st, msg, 0)) \
+    good = !!
+#define HtLegitLineP( st, p, msg ) \
+  for (bool ht_legit_ = good; ht_legit_; \
+       ht_legit_ = false, good = !!(p), \
+       good ? (void) 0 : htbog (st, msg, 0)) \
+    p =
+/** Like DoLegit(), for a block that sets {good}.**/
+#define HtLegit( st, msg ) \
+  for (bool ht_legit_ = good; ht_legit_; \
+       ht_legit_ = false, good ? (void) 0 : htbog (st, msg, 0))
+
+/** Flush the body once it holds this many bytes.**/
+#define BodyFlushSz ((zuint) 1 << 16)
+/** Most bytes of HTML that are held to keep the HTML of one \input file.**/
+#define MaxFragmentSz ((zuint) 1 << 20)
+
+/** Write out the finished part of the body, so that memory use
+ * does not grow with the size of the document.
+ *
+ * Text before the table of contents goes straight to {st->sink}.
+ * Text after it is spilled to a temporary file, since the table
+ * is not done until foot_html().
+ **/
+static
+  void
+flush_body_HtmlState (HtmlState* st)
+{
+  OFile* body = st->body_ofile;
+  struct iovec segs[2];
+  peak_stats_HtmlState (st);
+  if (!st->show_toc) {
+    drain_spill_HtmlState (st);
+    emit_HtmlState (st, segs, seg_OFile (segs, 1, body, 0, body->off));
+  }
+  else {
+    const zuint n = body->off - st->toc_pos;
+    AlphaTab ab;
+    if (!st->spill)
+      st->spill = tmpfile ();
+    if (!st->spill) {
+      /* Keep the text in memory instead.*/
+      return;
+    }
+    emit_HtmlState (st, segs, seg_OFile (segs, 1, body, 0, st->toc_pos));
+    ab = window2_OFile (body, st->toc_pos, body->off);
+    if (n != fwrite (ab.s, 1, n, st->spill)) {
+      htbog (st, "Cannot spill body to a temporary file", 0);
+      st->allgood = false;
+    }
+    st->toc_pos = 0;
+  }
+  lose_OFile (body);
+  init_OFile (body);
+}
+
+/** Give up on keeping the HTML of the \input files being converted,
+ * so that they no longer hold the body.
+ **/
+static inline
+  void
+drop_frag_holds_HtmlState (HtmlState* st)
+{
+  if (st->frag_holds > 0) {
+    st->frag_holds = 0;
+    st->frag_drops += 1;
+  }
+}
+
+/** Whether {of} is the body, is big enough to flush, and may be.
+ * \input files whose HTML may be kept hold the body until they have
+ * written MaxFragmentSz bytes, and are given up on after that.
+ **/
+static
+  bool
+flush_ck_HtmlState (HtmlState* st, const OFile* of)
+{
+  if (of != st->body_ofile || st->hold_flush > 0 || of->off < BodyFlushSz)
+    return false;
+  if (st->frag_holds > 0 && of->off - st->frag_hold_beg < MaxFragmentSz)
+    return false;
+  drop_frag_holds_HtmlState (st);
+  return true;
+}
+
+static void
+escape_for_html (OFile* of, XFile* xf, HtmlState* st);
+
+static void
+escape_html_XFile (OFile* of, XFile* xf, HtmlState* st, HtmlEscMode mode);
+
+/** Lowest stack address of the calling thread that nesting may reach,
+ * leaving StackMarginSz free, or 0 when the stack cannot be measured.
+ * Only glibc's pthread_getattr_np() is used to measure it,
+ * so elsewhere nesting is bounded by MaxBodyDepth alone.
+ **/
+static
+  uintptr_t
+stack_limit_thread ()
+{
+  static __thread uintptr_t limit = 0;
+  static __thread bool known = false;
+  if (!known) {
+    pthread_attr_t attr;
+    void* addr = 0;
+    size_t sz = 0;
+    known = true;
+#if defined(__GLIBC__)
+    if (0 == pthread_getattr_np (pthread_self (), &attr)) {
+      if (0 == pthread_attr_getstack (&attr, &addr, &sz) &&
+          sz > 2 * StackMarginSz)
+        limit = (uintptr_t) addr + StackMarginSz;
+      pthread_attr_destroy (&attr);
+    }
+#else
+    (void) attr;
+    (void) addr;
+    (void) sz;
+#endif
+  }
+  return limit;
+}
+
+/** Whether parsing one more level inside the current one
+ * would leave too little stack.
+ * The outermost level finds the stack of the thread that is parsing,
+ * since an HtmlState may be used by one thread after another.
+ **/
+static
+  bool
+too_deep_HtmlState (HtmlState* st)
+{
+  char here;
+  if (st->body_depth == 0)
+    st->stack_limit = stack_limit_thread ();
+  if (st->stack_limit)
+    return ((uintptr_t) &here < st->stack_limit);
+  return (st->body_depth >= MaxBodyDepth);
+}
+
+/** Expand {macro}, whose arguments follow in braces in {xf}.
+ * Each argument is rendered once, and the rendered arguments are
+ * joined with the pieces of the macro's template.
+ * The macro's own text is not parsed again.
+ **/
+static
+  void
+expand_Macro (OFile* of, XFile* xf, HtmlState* st, const Macro* macro,
+              HtmlEscMode mode)
+{
+  OFile args[MaxMacroArgs];
+  const char* html = ccstr_of_AlphaTab (&macro->html);
+  bool good = true;
+
+  /* Values were expanded when they were defined, so only arguments
+   * that are written inside each other nest here.
+   */
+  if (too_deep_HtmlState (st)) {
+    htbog (st, "Macros nest too deeply at: \\",
+           ccstr_of_AlphaTab (&macro->name));
+    st->allgood = false;
+    return;
+  }
+  ++ st->body_depth;
+
+  for (i ; macro->nargs)
+    init_OFile (&args[i]);
+  for (uint i = 0; good && i < macro->nargs; ++i) {
+    XFile olay[1];
+    good = (skip_cstr_XFile (xf, "{") &&
+            getbraced_olay_TexIndex (st->index, olay, xf));
+    if (good)
+      escape_html_XFile (&args[i], olay, st, mode);
+  }
+
+  if (!good) {
+    htbog (st, "Missing argument for macro: \\",
+           ccstr_of_AlphaTab (&macro->name));
+    st->allgood = false;
+  }
+  else {
+    for (i ; macro->pieces.sz) {
+      const MacroPiece* piece = &macro->pieces.s[i];
+      if (piece->arg > 0) {
+        OFile* arg = &args[piece->arg - 1];
+        AlphaTab ab = window2_OFile (arg, 0, arg->off);
+        oputn_char_OFile (of, ab.s, arg->off);
+      }
+      else if (mode == HtmlEscAttr && macro->attr_sz > 0) {
+        oput_attr_html (of, &html[piece->off], piece->sz);
+      }
+      else {
+        oputn_char_OFile (of, &html[piece->off], piece->sz);
+      }
+    }
+  }
+
+  for (i ; macro->nargs)
+    lose_OFile (&args[i]);
+  -- st->body_depth;
+}
+
+/** Expand the macro whose name follows a backslash in {xf}.
+ * Its value is written as is, or in its attribute form for {HtmlEscAttr}.
+ **/
+static void
+handle_macro (OFile* of, XFile* xf, HtmlState* st, HtmlEscMode mode)
+{
+  static const char macro_delims[] = "{}()[]\\/. \n\t_";
+  char* pos = tods_XFile (xf, macro_delims);
+  const char* sym_cstr = ccstr_of_XFile (xf);
+  char match = pos[0];
+  Macro* macro;
+  IrNode node[1];
+
+  if (sym_cstr == pos) {
+    switch (match) {
+    case '\\':
+      oput_char_OFile (of, '\n');
+      break;
+    case '_':
+    case '%':
+      oput_char_OFile (of, match);
+      break;
+    default:
+      {
+        char sym_buf[2] = { match, '\0' };
+        htbog (st, "I don't yet understand: \\", sym_buf);
+      }
+      break;
+    }
+
+    if (match)
+      offto_XFile (xf, &pos[1]);
+    return;
+  }
+  macro = find_MacroMap (&st->macros, sym_cstr, (uint) (pos - sym_cstr));
+  if (StatsOn(st)) {
+    if (macro)
+      st->stats->nmacro_hits += 1;
+    else
+      st->stats->nmacro_misses += 1;
+  }
+  if (macro) {
+    init_IrNode (node, IrMacro);
+    node->attr = ccstr_of_AlphaTab (&macro->name);
+    open_IrNode (of, st, node, &sym_cstr[-1]);
+  }
+  if (!macro) {
+    /* Only an unknown name is cut off, to report it.*/
+    pos[0] = '\0';
+    htbog (st, "I don't yet understand: \\", sym_cstr);
+    pos[0] = match;
+  }
+  else if (macro->nargs > 0) {
+    offto_XFile (xf, pos);
+    expand_Macro (of, xf, st, macro, mode);
+    close_IrNode (of, st, node, ccstr_of_XFile (xf));
+    return;
+  }
+  else if (mode == HtmlEscAttr && macro->attr_sz > 0) {
+    oputn_char_OFile (of, ccstr_of_AlphaTab (&macro->attr), macro->attr_sz);
+  }
+  else {
+    oputn_char_OFile (of, ccstr_of_AlphaTab (&macro->html), macro->html_sz);
+  }
+
+  offto_XFile (xf, pos);
+  if (match == '{') {
+    nextds_XFile (xf, 0, "}");
+  }
+  if (macro)
+    close_IrNode (of, st, node, ccstr_of_XFile (xf));
+}
+
+/** Write {xf} to {of} with HTML escaping for {mode}.
+ * Macros are expanded unless {st} is null.
+ **/
+static
+  void
+escape_html_XFile (OFile* of, XFile* xf, HtmlState* st, HtmlEscMode mode)
+{
+  char* s = cstr_of_XFile (xf);
+  /* The text ends where the buffer of {xf} does, at its NUL,
+   * so it needs no search. Macros only consume text before this.
+   */
+  char* const end = &xf->buf.s[xf->buf.sz - 1];
+
+  if (StatsOn(st))
+    st->stats->escape_sz += end - s;
+
+  while (s < end)
+  {
+    const zuint n = plain_span_html (s, end - s, mode, !!st);
+    if (n > 0)
+      oputn_char_OFile (of, s, n);
+    s = &s[n];
+    if (s == end)
+      break;
+
+    if (*s == '\\') {
+      offto_XFile (xf, &s[1]);
+      handle_macro (of, xf, st, mode);
+      s = cstr_of_XFile (xf);
+    }
+    else {
+      oput_cstr_OFile (of, entity_html (*s, mode));
+      ++ s;
+    }
+  }
+  offto_XFile (xf, end);
+}
+
+/** Write {xf} to {of} with HTML escaping.
+ * Macros are expanded unless {st} is null.
+ **/
+  void
+escape_for_html (OFile* of, XFile* xf, HtmlState* st)
+{
+  escape_html_XFile (of, xf, st, HtmlEscText);
+}
+
+/** Like escape_for_html(), but for a quoted attribute value.**/
+static
+  void
+escape_attr_for_html (OFile* of, XFile* xf, HtmlState* st)
+{
+  escape_html_XFile (of, xf, st, HtmlEscAttr);
+}
+
+/** Define the macro {key_cstr} with {nargs} arguments.
+ *
+ * Its value is expanded and escaped now, so each use is a plain copy.
+ * With arguments, the value is compiled into a template of HTML pieces
+ * and argument slots, where #1 through #{nargs} mark the slots.
+ **/
+static
+  void
+add_newcommand (HtmlState* st, const char* key_cstr, uint nargs,
+                const char* val_cstr)
+{
+  AlphaTab val[1];
+  OFile otmp[] = default;
+  TableT(MacroPiece) pieces = DEFAULT_Table;
+  const ArenaMark mark = mark_Arena (st->arena);
+  IrNode* ir_cur;
+  char* s;
+  Macro* macro;
+
+  /* Copy the value since argument slots are cut out of it in place.*/
+  s = dup_Arena (st->arena, val_cstr, strlen (val_cstr));
+  ir_cur = pause_Ir (st);
+  for (;;) {
+    char* p = s;
+    XFile olay[1];
+    AlphaTab ab = dflt_AlphaTab ();
+    const zuint off = otmp->off;
+
+    while (nargs > 0 && (p = strchr (p, '#')) &&
+           !('1' <= p[1] && p[1] <= (char) ('0' + nargs)))
+      ++ p;
+    if (nargs == 0)
+      p = 0;
+    if (p)
+      p[0] = '\0';
+
+    ab.s = s;
+    ab.sz = strlen (s) + 1;
+    init_XFile_olay_AlphaTab (olay, &ab);
+    escape_for_html (otmp, olay, st);
+    if (otmp->off > off) {
+      MacroPiece* piece = Grow1Table( pieces );
+      piece->off = off;
+      piece->sz = otmp->off - off;
+      piece->arg = 0;
+    }
+
+    if (!p)
+      break;
+    {
+      MacroPiece* piece = Grow1Table( pieces );
+      piece->off = 0;
+      piece->sz = 0;
+      piece->arg = (uint) (p[1] - '0');
+    }
+    s = &p[2];
+  }
+  release_Arena (st->arena, mark);
+  resume_Ir (st, ir_cur);
+  init_AlphaTab_move_OFile (val, otmp);
+
+  macro = ensure_MacroMap (&st->macros, key_cstr);
+  set_html_Macro (macro, val);
+  if (nargs > 0) {
+    LoseTable( macro->pieces );
+    macro->pieces = pieces;
+    macro->nargs = nargs;
+  }
+  else {
+    LoseTable( pieces );
+  }
+  fingerprint_MacroMap (&st->macros, macro);
+}
+
+/** Parse the rest of \newcommand{\NAME}[N]{VALUE}.
+ * The number of arguments N is optional.
+ **/
+static
+  bool
+parse_newcommand (XFile* xfile, HtmlState* st)
+{
+  DeclLegit( good );
+  Trit mayflush = mayflush_XFile (xfile, Nil);
+  char* key_cstr = 0;
+  char* val_cstr = 0;
+  int nargs = 0;
+
+  HtLegitLineP( st, key_cstr, "need argument for \\newcommand" )
+    getlined_XFile (xfile, "}");
+
+  if (good && skip_cstr_XFile (xfile, "[")) {
+    const char* nargs_cstr = 0;
+    HtLegitLineP( st, nargs_cstr, "need ] after number of arguments" )
+      getlined_XFile (xfile, "]");
+    if (good)
+      nargs = atoi (nargs_cstr);
+    HtLegitLine( st, "\\newcommand takes 1 to 9 arguments" )
+      (1 <= nargs && nargs <= MaxMacroArgs);
+  }
+
+  HtLegitLine( st, "need second argument for \\newcommand" )
+    skip_cstr_XFile (xfile, "{");
+  HtLegitLineP( st, val_cstr, "need second argument for \\newcommand" )
+    getmatchd_XFile (xfile, "{", "}");
+
+  DoLegit( 0 ) {
+    add_newcommand (st, key_cstr, (uint) nargs, val_cstr);
+  }
+  mayflush_XFile (xfile, mayflush);
+  return !!good;
+}
+
+/** Define the macros of the \newcommand lines in {xf}.**/
+static
+  bool
+parse_newcommands (HtmlState* st, XFile* xf)
+{
+  DeclLegit( good );
+  while (good && getlined_XFile (xf, "\\")) {
+    if (skip_cstr_XFile (xf, "newcommand{\\"))
+      good = parse_newcommand (xf, st);
+  }
+  return good;
+}
+
+/** Define the macros of a preamble file, which holds \newcommand lines.**/
+static
+  bool
+htpreamble (HtmlState* st, XFile* xf)
+{
+  xget_XFile (xf);
+  return parse_newcommands (st, xf);
+}
+
+/** Tag at the start of a preamble snapshot, with its format version.**/
+#define PreambleMagic "t2wp0002"
+
+/*
+ * A preamble snapshot holds, in host byte order:
+ *   PreambleMagic
+ *   CSS path: u32 size, then that many bytes and a NUL
+ *   u32 number of search paths, each stored like the CSS path
+ *   u32 number of macros, each stored as:
+ *     u32 name size, u32 name hash, u32 HTML size, u32 attribute size,
+ *     u32 nargs, u32 number of pieces, u64 fingerprint,
+ *     name and NUL, HTML and NUL, attribute form of the HTML and NUL,
+ *     and u32 off, u32 sz, u32 arg for each piece.
+ * Everything that a macro needs is stored, so loading it computes
+ * nothing, and its strings are used where they lie in the file.
+ */
+
+static
+  void
+oput_u32_preamble (OFile* of, uint32_t x)
+{
+  oputn_char_OFile (of, (const char*) &x, sizeof (x));
+}
+
+static
+  void
+oput_u64_preamble (OFile* of, uint64_t x)
+{
+  oputn_char_OFile (of, (const char*) &x, sizeof (x));
+}
+
+static
+  void
+oput_str_preamble (OFile* of, const char* s, zuint n)
+{
+  oput_u32_preamble (of, (uint32_t) n);
+  oputn_char_OFile (of, s, n);
+  oput_char_OFile (of, '\0');
+}
+
+/** Write the macros, search paths and CSS path of {st} as a snapshot
+ * that load_preamble() reads back.
+ **/
+static
+  bool
+dump_preamble (HtmlState* st)
+{
+  OFile of[] = default;
+  const char* css = ccstr_of_AlphaTab (&st->css_filepath);
+  struct iovec segs[1];
+
+  oputn_char_OFile (of, PreambleMagic, strlen (PreambleMagic));
+  oput_str_preamble (of, css, strlen (css));
+  oput_u32_preamble (of, (uint32_t) st->search_paths.sz);
+  for (i ; st->search_paths.sz) {
+    const char* path = ccstr_of_AlphaTab (&st->search_paths.s[i]);
+    oput_str_preamble (of, path, strlen (path));
+  }
+  oput_u32_preamble (of, (uint32_t) st->macros.macros.sz);
+  for (i ; st->macros.macros.sz) {
+    const Macro* macro = &st->macros.macros.s[i];
+    oput_u32_preamble (of, macro->name_sz);
+    oput_u32_preamble (of, macro->hash);
+    oput_u32_preamble (of, (uint32_t) macro->html_sz);
+    oput_u32_preamble (of, (uint32_t) macro->attr_sz);
+    oput_u32_preamble (of, macro->nargs);
+    oput_u32_preamble (of, (uint32_t) macro->pieces.sz);
+    oput_u64_preamble (of, macro->fingerprint);
+    oputn_char_OFile (of, ccstr_of_AlphaTab (&macro->name), macro->name_sz);
+    oput_char_OFile (of, '\0');
+    oputn_char_OFile (of, ccstr_of_AlphaTab (&macro->html), macro->html_sz);
+    oput_char_OFile (of, '\0');
+    if (macro->attr_sz > 0)
+      oputn_char_OFile (of, ccstr_of_AlphaTab (&macro->attr), macro->attr_sz);
+    oput_char_OFile (of, '\0');
+    for (j ; macro->pieces.sz) {
+      const MacroPiece* piece = &macro->pieces.s[j];
+      oput_u32_preamble (of, (uint32_t) piece->off);
+      oput_u32_preamble (of, (uint32_t) piece->sz);
+      oput_u32_preamble (of, piece->arg);
+    }
+  }
+
+  segs[0].iov_base = window2_OFile (of, 0, of->off).s;
+  segs[0].iov_len = of->off;
+  writev_OSink (st->sink, segs, 1);
+  lose_OFile (of);
+  return st->sink->good;
+}
+
+/** Reader over the bytes of a snapshot.**/
+typedef struct PreambleReader PreambleReader;
+struct PreambleReader
+{
+  const char* s;
+  zuint off;
+  zuint sz;
+  bool good;
+};
+
+static
+  uint32_t
+u32_PreambleReader (PreambleReader* in)
+{
+  uint32_t x;
+  if (!in->good || in->sz - in->off < sizeof (x)) {
+    in->good = false;
+    return 0;
+  }
+  memcpy (&x, &in->s[in->off], sizeof (x));
+  in->off += sizeof (x);
+  return x;
+}
+
+static
+  uint64_t
+u64_PreambleReader (PreambleReader* in)
+{
+  uint64_t x;
+  if (!in->good || in->sz - in->off < sizeof (x)) {
+    in->good = false;
+    return 0;
+  }
+  memcpy (&x, &in->s[in->off], sizeof (x));
+  in->off += sizeof (x);
+  return x;
+}
+
+/** Take {n} bytes and a NUL, returning them as a C string.**/
+static
+  const char*
+cstr_PreambleReader (PreambleReader* in, zuint n)
+{
+  const char* s = &in->s[in->off];
+  if (!in->good || in->sz - in->off <= n || s[n] != '\0') {
+    in->good = false;
+    return "";
+  }
+  in->off += n + 1;
+  return s;
+}
+
+/** Load a snapshot written by dump_preamble() into {st}.
+ * The file stays mapped for as long as {st} lives, and the names and
+ * values of its macros are used in place. Nothing is parsed or hashed.
+ **/
+static
+  bool
+load_preamble (HtmlState* st, const char* filename)
+{
+  PreambleReader in[1];
+  struct stat sb;
+  void* map;
+  uint32_t n;
+  const zuint magic_sz = strlen (PreambleMagic);
+  int fd;
+
+  /* Macros may already point into the one that is mapped.*/
+  if (st->preamble_map)
+    return false;
+  fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (0 != fstat (fd, &sb) || (zuint) sb.st_size < magic_sz) {
+    close (fd);
+    return false;
+  }
+  map = mmap (0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return false;
+  st->preamble_map = map;
+  st->preamble_map_sz = sb.st_size;
+
+  in->s = (const char*) map;
+  in->off = magic_sz;
+  in->sz = sb.st_size;
+  in->good = (0 == memcmp (in->s, PreambleMagic, magic_sz));
+
+  n = u32_PreambleReader (in);
+  copy_cstr_AlphaTab (&st->css_filepath, cstr_PreambleReader (in, n));
+
+  n = u32_PreambleReader (in);
+  for (uint32_t i = 0; in->good && i < n; ++i) {
+    const uint32_t sz = u32_PreambleReader (in);
+    const char* path = cstr_PreambleReader (in, sz);
+    if (in->good)
+      *Grow1Table( st->search_paths ) = cons1_AlphaTab (path);
+  }
+
+  n = u32_PreambleReader (in);
+  for (uint32_t i = 0; in->good && i < n; ++i) {
+    const uint32_t name_sz = u32_PreambleReader (in);
+    const uint32_t hash = u32_PreambleReader (in);
+    const uint32_t html_sz = u32_PreambleReader (in);
+    const uint32_t attr_sz = u32_PreambleReader (in);
+    const uint32_t nargs = u32_PreambleReader (in);
+    const uint32_t npieces = u32_PreambleReader (in);
+    const uint64_t fingerprint = u64_PreambleReader (in);
+    const char* name = cstr_PreambleReader (in, name_sz);
+    const char* html = cstr_PreambleReader (in, html_sz);
+    const char* attr = cstr_PreambleReader (in, attr_sz);
+    Macro* macro;
+
+    if (!in->good || nargs > MaxMacroArgs) {
+      in->good = false;
+      break;
+    }
+    macro = find_hashed_MacroMap (&st->macros, name, name_sz, hash);
+    if (!macro)
+      macro = add_MacroMap (&st->macros, dflt1_AlphaTab ((char*) name),
+                            name_sz, hash);
+    lose_AlphaTab (&macro->html);
+    lose_AlphaTab (&macro->attr);
+    macro->html = dflt1_AlphaTab ((char*) html);
+    macro->html_sz = html_sz;
+    macro->attr = (attr_sz > 0 ? dflt1_AlphaTab ((char*) attr)
+                   : dflt_AlphaTab ());
+    macro->attr_sz = attr_sz;
+    macro->nargs = nargs;
+    macro->pieces.sz = 0;
+    for (uint32_t j = 0; in->good && j < npieces; ++j) {
+      MacroPiece* piece = Grow1Table( macro->pieces );
+      piece->off = u32_PreambleReader (in);
+      piece->sz = u32_PreambleReader (in);
+      piece->arg = u32_PreambleReader (in);
+      if (piece->off + piece->sz > html_sz || piece->arg > nargs)
+        in->good = false;
+    }
+    st->macros.fingerprint ^= macro->fingerprint;
+    macro->fingerprint = fingerprint;
+    st->macros.fingerprint ^= macro->fingerprint;
+  }
+  return in->good;
+}
+
+/** Escape {olay} as a head field, keeping the text in {st->arena}.**/
+static
+  AlphaTab
+head_field_HtmlState (HtmlState* st, XFile* olay)
+{
+  OFile* tmp = st->tmp_ofile;
+  const zuint off = tmp->off;
+  escape_for_html (tmp, olay, st);
+  return dflt1_AlphaTab (dup_Arena (st->arena,
+                                    window2_OFile (tmp, off, tmp->off).s,
+                                    tmp->off - off));
+}
+
+static
+  bool
+hthead (HtmlState* st, XFile* xf)
+{
+  DeclLegit( good );
+  while (good)
+  {
+    XFile olay[1];
+    good = !!getlined_XFile (xf, "\\");
+    if (!good) {
+      return false;
+    }
+    else if (skip_cstr_XFile (xf, "begin{document}")) {
+      skipds_XFile (xf, WhiteSpaceChars);
+      break;
+    }
+    else if (skip_cstr_XFile (xf, "title[") ||
+             skip_cstr_XFile (xf, "title{"))
+    {
+      const bool optional = ('[' == *ccstr1_of_XFile (xf, xf->off-1));
+
+      HtLegitLine( st, "Second \\title?" )
+        null_ck_AlphaTab (&st->title);
+
+      if (optional) {
+        HtLegitLine( st, "title has no closing bracket / opening brace" )
+          getlined_olay_XFile (olay, xf, "]{");
+
+        if (good)
+          st->pagetitle = head_field_HtmlState (st, olay);
+      }
+
+      HtLegitLine( st, "title has no closing brace" )
+        getlined_olay_XFile (olay, xf, "}");
+
+      if (good) {
+        st->title = head_field_HtmlState (st, olay);
+        if (!optional) {
+          st->pagetitle = st->title;
+        }
+      }
+    }
+    else if (skip_cstr_XFile (xf, "author{"))
+    {
+      HtLegitLine( st, "no closing brace" )
+        getlined_olay_XFile (olay, xf, "}");
+
+      HtLegitLine( st, "Second \\author?" )
+        null_ck_AlphaTab (&st->author);
+
+      if (good)
+        st->author = head_field_HtmlState (st, olay);
+    }
+    else if (skip_cstr_XFile (xf, "date{"))
+    {
+      HtLegitLine( st, "no closing brace" )
+        getlined_olay_XFile (olay, xf, "}");
+      HtLegitLine( st, "Second \\date?" )
+        null_ck_AlphaTab (&st->date);
+      if (good)
+        st->date = head_field_HtmlState (st, olay);
+    }
+    else if (skip_cstr_XFile (xf, "newcommand{\\")) {
+      good = parse_newcommand (xf, st);
+    }
+  }
+  if (good) {
+    head_html (st);
+  }
+  st->allgood = st->allgood && good;
+  return good;
+}
+
+static
+  void
+open_paragraph (HtmlState* st)
+{
+  IrNode para[1];
+  if (st->inparagraph)  return;
+  init_IrNode (para, IrParagraph);
+  if (st->cram)
+    para->flags |= IrCram;
+  open_IrNode (st->body_ofile, st, para, 0);
+  st->inparagraph = true;
+  st->eol = false;
+  st->cram = true;
+}
+
+static
+  void
+close_paragraph (HtmlState* st)
+{
+  IrNode para[1];
+  if (!st->inparagraph)  return;
+  init_IrNode (para, IrParagraph);
+  para->kept = find_IrNode (st, IrParagraph);
+  close_IrNode (st->body_ofile, st, para, 0);
+  st->inparagraph = false;
+  st->cram = false;
+  st->eol = false;
+}
+
+/** The recorded item that is open in the innermost open list.**/
+static
+  IrNode*
+find_item_IrNode (HtmlState* st)
+{
+  IrNode* list = find_IrNode (st, IrList);
+  IrNode* item = find_IrNode (st, IrItem);
+  return (item && item->parent == list) ? item : 0;
+}
+
+/** Close the list item that is open, which ends at {end}.**/
+static
+  void
+close_item (OFile* of, HtmlState* st, const char* end)
+{
+  IrNode item[1];
+  init_IrNode (item, IrItem);
+  item->kept = find_item_IrNode (st);
+  close_IrNode (of, st, item, end);
+}
+
+static
+  void
+open_list (HtmlState* st, const char* tag)
+{
+  IrNode list[1];
+  bool cram = st->inparagraph && st->list_depth == 0;
+  if (cram) {
+    close_paragraph (st);
+  }
+  st->inparagraph = true;
+
+  st->list_depth += 1;
+  init_IrNode (list, IrList);
+  list->attr = tag;
+  if (cram)
+    list->flags |= IrCram;
+  open_IrNode (st->body_ofile, st, list, st->cmd_beg);
+  st->list_item_open = false;
+}
+
+/** Close the innermost list, which ends at {end}.**/
+static
+  void
+close_list (HtmlState* st, const char* tag, const char* end)
+{
+  OFile* ofile = st->body_ofile;
+  IrNode list[1];
+  if (st->list_item_open) {
+    close_item (ofile, st, st->cmd_beg);
+  }
+  init_IrNode (list, IrList);
+  list->attr = tag;
+  list->kept = find_IrNode (st, IrList);
+  close_IrNode (ofile, st, list, end);
+  st->list_depth -= 1;
+  if (st->list_depth > 0) {
+    /* A nested list ends the item that it is in.*/
+    close_item (ofile, st, end);
+  }
+  else {
+    st->inparagraph = false;
+  }
+  st->list_item_open = false;
+}
+
+static
+  bool
+insert_href (HtmlState* st, XFile* xf, bool black)
+{
+  DeclLegit( good );
+  OFile* of = st->body_ofile;
+  XFile olay[1];
+  IrNode link[1];
+  const char* beg = st->cmd_beg;
+  open_paragraph (st);
+  init_IrNode (link, IrLink);
+  if (black)
+    link->flags |= IrBlack;
+  HtLegitLine( st, "no closing/open for href" )
+    getlined_olay_XFile (olay, xf, "}{");
+
+  HtLegit( st, "no closing brace for href" )
+  {
+    link->attr = ccstr_of_XFile (olay);
+    good = getlined_olay_XFile (olay, xf, "}");
+  }
+  if (good) {
+    open_IrNode (of, st, link, beg);
+    htbody (of, olay, st);
+    close_IrNode (of, st, link, ccstr_of_XFile (xf));
+  }
+  return good;
+}
+
+static
+  bool
+next_section (OFile* of, XFile* xf, HtmlState* st, uint flags)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  OFile* toc = st->toc_ofile;
+  const Trit mayflush = mayflush_XFile (xf, Nil);
+  const ArenaMark mark = mark_Arena (st->arena);
+  const char* beg = st->cmd_beg;
+  const char* label = 0;
+  bool subsec = (st->nsubsections > 0);
+  IrNode node[1];
+
+  HtLegitLine( st, "no closing brace for \\section" )
+    getbraced_olay_TexIndex (st->index, olay, xf);
+
+  if (!good) {
+    mayflush_XFile (xf, mayflush);
+    return false;
+  }
+
+  skipds_XFile (xf, WhiteSpaceChars);
+  if (skip_cstr_XFile (xf, "\\label{")) {
+    label = getlined_XFile (xf, "}");
+  }
+  if (!label || label[0] == '\0') {
+    char buf[64];
+    if (subsec)
+      sprintf (buf, "sec:%u.%u", st->nsections, st->nsubsections);
+    else
+      sprintf (buf, "sec:%u", st->nsections);
+    label = dup_Arena (st->arena, buf, strlen (buf));
+  }
+  init_IrNode (node, subsec ? IrSubsection : IrSection);
+  node->flags = flags;
+  node->attr = label;
+  node->num[0] = st->nsections;
+  node->num[1] = st->nsubsections;
+
+  st->inparagraph = true;
+
+  open_IrNode (of, st, node, beg);
+  {
+    /* The title is parsed twice, and parsing writes into its text.*/
+    const char* title = ccstr_of_XFile (olay);
+    const zuint n = strlen (title);
+    AlphaTab tmp = dflt_AlphaTab ();
+    XFile olay2[1];
+    IrSrc src;
+    tmp.s = dup_Arena (st->arena, title, n);
+    tmp.sz = n + 1;
+    init_XFile_olay_AlphaTab (olay2, &tmp);
+    src = enter_Ir (st, tmp.s, title, 0);
+    htbody (of, olay2, st);
+    leave_Ir (st, &src);
+  }
+  close_IrNode (of, st, node, ccstr_of_XFile (xf));
+
+  oput_toc_open_IrNode (toc, node);
+  {
+    /* The title is already in the IR.*/
+    IrNode* ir_cur = pause_Ir (st);
+    htbody (toc, olay, st);
+    resume_Ir (st, ir_cur);
+  }
+  oput_toc_close_IrNode (toc, node);
+  release_Arena (st->arena, mark);
+
+  st->inparagraph = false;
+
+  mayflush_XFile (xf, mayflush);
+  return true;
+}
+
+
+typedef bool (*HtCmdFn) (OFile*, XFile*, HtmlState*, const HtCmd*);
+
+/** Flags of a command in the dispatch table.**/
+enum HtCmdFlag
+{
+  /** The command must be followed by an opening brace, which is consumed.**/
+  HtCmd_Brace = 1 << 0,
+  /** The command must be followed by a newline, which is consumed.**/
+  HtCmd_Eol = 1 << 1,
+  /** The command is inline, so a pending newline is written before it.**/
+  HtCmd_Inline = 1 << 2,
+  /** Do not expand macros in the command's argument.**/
+  HtCmd_Verbatim = 1 << 3,
+  /** An optional [argument] may come before the brace.
+   * The command reads both itself.
+   **/
+  HtCmd_Opt = 1 << 4
+};
+
+/** A command that htbody() knows how to handle.
+ *
+ * The {name} is what follows the backslash.
+ * For environments, it includes the braces as in "begin{center}".
+ * The {open} and {close} strings are passed to the handler {fn},
+ * which decides what they mean.
+ **/
+struct HtCmd
+{
+  const char* name;
+  uint name_sz;
+  uint flags;
+  HtCmdFn fn;
+  const char* open;
+  const char* close;
+  /** Kind of the IR node whose tags are {open} and {close},
+   * when it is not IrCommand.
+   **/
+  uint ir;
+};
+
+/** Start a node for {cmd}, whose tags are in the table of commands.**/
+static
+  void
+init_cmd_IrNode (IrNode* node, const HtCmd* cmd)
+{
+  init_IrNode (node, cmd->ir ? cmd->ir : IrCommand);
+  node->attr = cmd->name;
+  node->cmd = cmd;
+}
+
+static
+  bool
+ht_literal (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  IrNode node[1];
+  open_paragraph (st);
+  init_cmd_IrNode (node, cmd);
+  put_IrNode (of, st, node, st->cmd_beg, ccstr_of_XFile (xf));
+  return true;
+}
+
+static
+  bool
+ht_open_list (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  (void) of;
+  (void) xf;
+  open_list (st, cmd->open);
+  return true;
+}
+
+static
+  bool
+ht_close_list (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  (void) of;
+  close_list (st, cmd->open, ccstr_of_XFile (xf));
+  return true;
+}
+
+static
+  bool
+ht_item (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  IrNode item[1];
+  (void) xf;
+  (void) cmd;
+  if (st->list_item_open) {
+    close_item (of, st, st->cmd_beg);
+  }
+  init_IrNode (item, IrItem);
+  open_IrNode (of, st, item, st->cmd_beg);
+  st->list_item_open = true;
+  return true;
+}
+
+static
+  bool
+ht_newcommand (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  (void) of;
+  (void) cmd;
+  /* Only the brace was skipped, so the name still has its backslash.*/
+  if (!skip_cstr_XFile (xf, "\\"))
+    return false;
+  return parse_newcommand (xf, st);
+}
+
+/** Write an argument with HTML escaping between the {open} and {close} tags.**/
+static
+  bool
+ht_escaped (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  IrNode node[1];
+  const char* beg = st->cmd_beg;
+  open_paragraph (st);
+  HtLegitLine( st, "no closing brace" )
+    getbraced_olay_TexIndex (st->index, olay, xf);
+  if (good) {
+    init_cmd_IrNode (node, cmd);
+    open_IrNode (of, st, node, beg);
+    put_text_IrNode (of, st, olay, (cmd->flags & HtCmd_Verbatim));
+    close_IrNode (of, st, node, ccstr_of_XFile (xf));
+  }
+  return good;
+}
+
+static
+  bool
+ht_quicksec (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  close_paragraph (st);
+  return ht_escaped (of, xf, st, cmd);
+}
+
+/** Like ht_escaped(), but the argument may contain more commands.**/
+static
+  bool
+ht_nested (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  IrNode node[1];
+  const char* beg = st->cmd_beg;
+  open_paragraph (st);
+  HtLegitLine( st, "no closing brace" )
+    getbraced_olay_TexIndex (st->index, olay, xf);
+  if (good) {
+    init_cmd_IrNode (node, cmd);
+    open_IrNode (of, st, node, beg);
+    htbody (of, olay, st);
+    close_IrNode (of, st, node, ccstr_of_XFile (xf));
+  }
+  return good;
+}
+
+static
+  bool
+ht_code (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  IrNode node[1];
+  const char* beg = st->cmd_beg;
+  init_cmd_IrNode (node, cmd);
+  if (st->inparagraph || st->cram) {
+    node->flags |= IrCram;
+  }
+  close_paragraph (st);
+
+  HtLegitLine( st, "Need \\end{code} for \\begin{code}!" )
+    getenv_olay_TexIndex (st->index, olay, xf, "code", TexEnv_Eol);
+  if (good) {
+    open_IrNode (of, st, node, beg);
+    put_text_IrNode (of, st, olay, true);
+    close_IrNode (of, st, node, ccstr_of_XFile (xf));
+  }
+  st->cram = true;
+  return good;
+}
+
+/** Most listing files whose lines are kept.**/
+#define MaxLineIndexes 64
+/** Bytes of a listing that are escaped into one buffer at a time.**/
+#define ListingBufSz ((zuint) 1 << 16)
+/** Runs of a listing that need no escaping and are at least this long
+ * are written from the file itself.
+ **/
+#define ListingDirectSz 256
+
+/** Read the options of \codeinputlisting, as in "firstline=3,lastline=9".
+ * Lines are counted from 1. A {*ret_last} of 0 means the last line.
+ **/
+static
+  bool
+parse_listing_opts (const char* s, uint* ret_first, uint* ret_last)
+{
+  for (;;) {
+    uint* ret;
+    char* end;
+    unsigned long x;
+    s = &s[strspn (s, WhiteSpaceChars)];
+    if (*s == '\0')
+      return true;
+    if (0 == strncmp (s, "firstline=", 10)) {
+      ret = ret_first;
+      s = &s[10];
+    }
+    else if (0 == strncmp (s, "lastline=", 9)) {
+      ret = ret_last;
+      s = &s[9];
+    }
+    else {
+      return false;
+    }
+    x = strtoul (s, &end, 10);
+    if (end == s || x == 0 || x > UINT_MAX)
+      return false;
+    *ret = (uint) x;
+    s = &end[strspn (end, WhiteSpaceChars)];
+    if (*s == ',')
+      ++ s;
+    else if (*s != '\0')
+      return false;
+  }
+}
+
+/** Note where each line of the {n} bytes at {s} starts, and then {n}.**/
+static
+  void
+build_lines (TableT(zuint)* offs, const char* s, zuint n)
+{
+  const char* p = s;
+  offs->sz = 0;
+  *Grow1Table( *offs ) = 0;
+  while ((p = (const char*) memchr (p, '\n', n - (zuint) (p - s)))) {
+    ++ p;
+    *Grow1Table( *offs ) = (zuint) (p - s);
+  }
+  *Grow1Table( *offs ) = n;
+}
+
+/** Cut the {*n} bytes at {*s} of the listing {filename} in {dir}
+ * down to the lines {first} through {last}.
+ * The line offsets of a file are kept in {st} for as long as
+ * the file is unchanged, so each cut only looks up two offsets.
+ **/
+static
+  void
+cut_listing_lines (HtmlState* st, const char* dir, const char* filename,
+                   const char** s, zuint* n, uint first, uint last)
+{
+  TableT(zuint) tmp = DEFAULT_Table;
+  TableT(zuint)* offs = &tmp;
+  FileDep dep[1];
+  zuint nlines;
+  zuint beg;
+  zuint end;
+
+  if (!st->include && stat_FileDep (dep, dir, filename, 0)) {
+    LineIndex* idx = 0;
+    for (i ; st->line_indexes.sz) {
+      if (eq_cstr (ccstr_of_AlphaTab (&st->line_indexes.s[i].file.path),
+                   ccstr_of_AlphaTab (&dep->path)))
+        idx = &st->line_indexes.s[i];
+    }
+    if (!idx && dep->sz == *n && st->line_indexes.sz < MaxLineIndexes) {
+      idx = Grow1Table( st->line_indexes );
+      idx->file = *dep;
+      idx->file.path = cons1_AlphaTab (ccstr_of_AlphaTab (&dep->path));
+      idx->file.sz = *n + 1;
+      InitTable( idx->offs );
+    }
+    if (idx && dep->sz == *n) {
+      if (idx->file.sz != *n ||
+          idx->file.mtime.tv_sec != dep->mtime.tv_sec ||
+          idx->file.mtime.tv_nsec != dep->mtime.tv_nsec)
+      {
+        build_lines (&idx->offs, *s, *n);
+        idx->file.mtime = dep->mtime;
+        idx->file.sz = *n;
+      }
+      offs = &idx->offs;
+    }
+    lose_AlphaTab (&dep->path);
+  }
+  if (offs == &tmp)
+    build_lines (&tmp, *s, *n);
+
+  nlines = offs->sz - 1;
+  beg = offs->s[first - 1 < nlines ? first - 1 : nlines];
+  end = (last == 0 || last > nlines) ? *n : offs->s[last];
+  if (end < beg)
+    end = beg;
+  *s = &(*s)[beg];
+  *n = end - beg;
+  LoseTable( tmp );
+}
+
+/** Segments of an escaped listing on their way to the sink.
+ * Slot 0 is kept for the head, as emit_HtmlState() needs.
+ **/
+typedef struct ListingOut ListingOut;
+struct ListingOut
+{
+  HtmlState* st;
+  struct iovec segs[64];
+  uint nsegs;
+  /** Short runs and entities, copied so they make few segments.**/
+  char buf[ListingBufSz];
+  zuint buf_off;
+};
+
+static
+  void
+emit_ListingOut (ListingOut* lo)
+{
+  if (lo->nsegs > 1)
+    emit_HtmlState (lo->st, lo->segs, lo->nsegs);
+  lo->nsegs = 1;
+  lo->buf_off = 0;
+}
+
+/** Add the {n} bytes at {s}, which stay valid until they are emitted
+ * when {direct}, and are copied otherwise.
+ **/
+static
+  void
+put_ListingOut (ListingOut* lo, const char* s, zuint n, bool direct)
+{
+  struct iovec* seg;
+  if (n == 0)
+    return;
+  if (lo->nsegs == ArraySz(lo->segs) ||
+      (!direct && lo->buf_off + n > sizeof (lo->buf)))
+    emit_ListingOut (lo);
+  seg = &lo->segs[lo->nsegs-1];
+  if (direct) {
+    ++ seg;
+    seg->iov_base = (char*) s;
+    seg->iov_len = n;
+    ++ lo->nsegs;
+    return;
+  }
+  memcpy (&lo->buf[lo->buf_off], s, n);
+  if (lo->nsegs > 1 &&
+      (char*) seg->iov_base + seg->iov_len == &lo->buf[lo->buf_off])
+  {
+    seg->iov_len += n;
+  }
+  else {
+    ++ seg;
+    seg->iov_base = &lo->buf[lo->buf_off];
+    seg->iov_len = n;
+    ++ lo->nsegs;
+  }
+  lo->buf_off += n;
+}
+
+/** Write the {n} bytes at {s} of a code listing to {of}, escaped.
+ *
+ * A large listing in the body that can be flushed skips {of}.
+ * The body before it is flushed, then the listing goes to the sink
+ * in chunks of ListingBufSz, with long runs that need no escaping
+ * written straight from {s}.
+ **/
+static
+  void
+oput_listing_HtmlState (HtmlState* st, OFile* of, const char* s, zuint n)
+{
+  ListingOut* lo;
+  if (of != st->body_ofile || st->hold_flush > 0 || st->frag_holds > 0 ||
+      st->show_toc || n < ListingBufSz)
+  {
+    oput_escaped_html (of, s, n, HtmlEscText);
+    return;
+  }
+  flush_body_HtmlState (st);
+  lo = AllocT( ListingOut, 1 );
+  lo->st = st;
+  lo->nsegs = 1;
+  lo->buf_off = 0;
+  while (n > 0) {
+    const zuint k = plain_span_html (s, n, HtmlEscText, false);
+    put_ListingOut (lo, s, k, k >= ListingDirectSz);
+    if (k == n)
+      break;
+    {
+      const char* ent = entity_html (s[k], HtmlEscText);
+      put_ListingOut (lo, ent, strlen (ent), false);
+    }
+    s = &s[k+1];
+    n -= k+1;
+  }
+  emit_ListingOut (lo);
+  free (lo);
+}
+
+static
+  bool
+ht_codeinputlisting (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  IrNode node[1];
+  const char* beg = st->cmd_beg;
+  InFile listing[1];
+  uint firstline = 1;
+  uint lastline = 0;
+  init_cmd_IrNode (node, cmd);
+  if (st->inparagraph || st->cram) {
+    node->flags |= IrCram;
+  }
+  close_paragraph (st);
+
+  if (skip_cstr_XFile (xf, "[")) {
+    HtLegitLine( st, "no closing bracket" )
+      getlined_olay_XFile (olay, xf, "]");
+    HtLegitLine( st, "unknown \\codeinputlisting option" )
+      parse_listing_opts (ccstr_of_XFile (olay), &firstline, &lastline);
+  }
+  /* The dispatcher leaves the brace, since options may come first.*/
+  HtLegitLine( st, "need a file name in braces after \\codeinputlisting" )
+    skip_cstr_XFile (xf, "{");
+  HtLegitLine( st, "no closing brace" )
+    getlined_olay_XFile (olay, xf, "}");
+  if (!good)
+    return false;
+
+  node->attr = ccstr_of_XFile (olay);
+  open_IrNode (of, st, node, beg);
+  init_InFile (listing);
+  HtLegit( st, "cannot open listing" )
+  {
+    const char* filename = ccstr_of_XFile (olay);
+    if (st->include)
+      good = include_InFile (listing, st->include, st->include_arg, filename);
+    else
+      good = open_InFile (listing, st->pathname, filename);
+  }
+  if (good && !st->include) {
+    add_dep_HtmlState (st, st->pathname, ccstr_of_XFile (olay),
+                       cstr_of_XFile (listing->xf));
+  }
+  if (good) {
+    const char* text = ccstr_of_XFile (listing->xf);
+    zuint n = strlen (text);
+    if (firstline > 1 || lastline > 0)
+      cut_listing_lines (st, st->pathname, ccstr_of_XFile (olay),
+                         &text, &n, firstline, lastline);
+    oput_listing_HtmlState (st, of, text, n);
+  }
+  close_IrNode (of, st, node, ccstr_of_XFile (xf));
+  lose_InFile (listing);
+  return good;
+}
+
+/** Wrap an environment in the {open} div.
+ * The {close} string names the environment, which may nest.
+ **/
+static
+  bool
+ht_align (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  IrNode node[1];
+  open_paragraph (st);
+  init_cmd_IrNode (node, cmd);
+  node->attr = cmd->close;
+  open_IrNode (of, st, node, st->cmd_beg);
+  HtLegitLine( st, "No end to alignment environment!" )
+    getenv_olay_TexIndex (st->index, olay, xf, cmd->close, TexEnv_Nest);
+  if (good) {
+    htbody (of, olay, st);
+    close_IrNode (of, st, node, ccstr_of_XFile (xf));
+  }
+  return good;
+}
+
+/** Opening tags of table cells by left line, alignment and right line.**/
+static const char* const td_tags[2][3][2] =
+{
+  {
+    { "\n<td>", "\n<td class=\"rline\">" },
+    { "\n<td class=\"cjust\">", "\n<td class=\"cjust rline\">" },
+    { "\n<td class=\"rjust\">", "\n<td class=\"rjust rline\">" }
+  },
+  {
+    { "\n<td class=\"lline\">", "\n<td class=\"lline rline\">" },
+    { "\n<td class=\"lline cjust\">",
+      "\n<td class=\"lline cjust rline\">" },
+    { "\n<td class=\"lline rjust\">",
+      "\n<td class=\"lline rjust rline\">" }
+  }
+};
+
+/** Opening tag of a table cell whose style is
+ * 6 * left line + 2 * alignment + right line.
+ **/
+static
+  const char*
+td_tag (uint style)
+{
+  return td_tags[style / 6][style / 2 % 3][style % 2];
+}
+
+/** Compile the column spec {cols} of a tabular into the style
+ * of the cells in each column, which is freed with free().
+ * Each column is an optional '|', one of "lcr", and an optional '|'.
+ * Return the number of columns.
+ * The style after them is for the cells past the last column.
+ **/
+static
+  uint
+compile_tabular_cols (uint** ret_tds, const char* cols)
+{
+  uint* tds = AllocT( uint, strlen (cols) + 1 );
+  uint n = 0;
+  for (;;) {
+    const char* const beg = cols;
+    uint lline = 0;
+    uint align = 0;
+    uint rline = 0;
+    if (*cols == '|') { ++cols; lline = 1; }
+    if      (*cols == 'l') { ++cols; align = 0; }
+    else if (*cols == 'c') { ++cols; align = 1; }
+    else if (*cols == 'r') { ++cols; align = 2; }
+    if (*cols == '|') { ++cols; rline = 1; }
+    if (cols == beg)  break;
+    tds[n++] = 6 * lline + 2 * align + rline;
+  }
+  tds[n] = 0;
+  *ret_tds = tds;
+  return n;
+}
+
+static
+  bool
+ht_tabular (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  const char* cols = 0;
+  const bool inparagraph = st->inparagraph;
+  const char* beg = st->cmd_beg;
+  HtLegitLine( st, "Need \\end{tabular} for \\begin{tabular}!" )
+    getenv_olay_TexIndex (st->index, olay, xf, "tabular",
+                          TexEnv_Eol | TexEnv_Nest);
+
+  HtLegitLineP( st, cols, "Need column spec for tabular!" )
+    getlined_XFile (olay, "}");
+
+  DoLegit( 0 ) {
+    uint i;
+    XFile line_olay[1];
+    IrNode table[1];
+    uint* tds = 0;
+    const uint ncols = compile_tabular_cols (&tds, cols);
+
+    init_cmd_IrNode (table, cmd);
+    table->attr = cols;
+    open_IrNode (of, st, table, beg);
+
+    while (getlined_olay_XFile (line_olay, olay, "\\\\")) {
+      XFile cell_olay[1];
+      IrNode row[1];
+      i = 0;
+      skipds_XFile (line_olay, 0);
+      init_IrNode (row, IrRow);
+      if (skip_cstr_XFile (line_olay, "\\hline"))
+        row->flags |= IrHline;
+      open_IrNode (of, st, row, ccstr_of_XFile (line_olay));
+
+      while (getlined_olay_XFile (cell_olay, line_olay, "&")) {
+        IrNode cell[1];
+        skipds_XFile (cell_olay, 0);
+        init_IrNode (cell, IrCell);
+        cell->num[0] = tds[i];
+        open_IrNode (of, st, cell, ccstr_of_XFile (cell_olay));
+        if (i < ncols)
+          ++ i;
+        st->inparagraph = true;
+        htbody (of, cell_olay, st);
+        close_IrNode (of, st, cell, ccstr_of_XFile (cell_olay));
+      }
+      close_IrNode (of, st, row, ccstr_of_XFile (line_olay));
+      /* Write out each row as it is done, as htbody() would,
+       * so a long table does not pile up in memory.
+       */
+      if (flush_ck_HtmlState (st, of))
+        flush_body_HtmlState (st);
+    }
+    close_IrNode (of, st, table, ccstr_of_XFile (xf));
+    st->inparagraph = inparagraph;
+    free (tds);
+  }
+  return good;
+}
+
+static
+  bool
+ht_tableofcontents (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  (void) of;
+  (void) xf;
+  (void) cmd;
+  /* Everything before the table can be written out now.
+   * An \input file that has a table is not kept anyway.
+   */
+  if (st->hold_flush == 0) {
+    drop_frag_holds_HtmlState (st);
+    st->show_toc = false;
+    flush_body_HtmlState (st);
+  }
+  st->show_toc = true;
+  st->toc_pos = st->body_ofile->off;
+  return true;
+}
+
+static
+  bool
+ht_section (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  const uint flags = (st->nsubsections > 0 ? IrEndSubs : 0);
+  (void) cmd;
+  close_paragraph (st);
+  ++ st->nsections;
+  st->nsubsections = 0;
+  return next_section (of, xf, st, flags);
+}
+
+static
+  bool
+ht_subsection (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  (void) cmd;
+  close_paragraph (st);
+  ++ st->nsubsections;
+  return next_section (of, xf, st, 0);
+}
+
+static
+  bool
+ht_label (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  IrNode node[1];
+  const char* beg = st->cmd_beg;
+  (void) cmd;
+  HtLegitLine( st, "no closing brace for \\label" )
+    getlined_olay_XFile (olay, xf, "}");
+  if (good) {
+    st->nsection_uses += 1;
+    init_IrNode (node, IrLabel);
+    node->attr = ccstr_of_XFile (olay);
+    node->num[0] = st->nsections;
+    put_IrNode (of, st, node, beg, ccstr_of_XFile (xf));
+  }
+  return good;
+}
+
+static
+  bool
+ht_href (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  (void) of;
+  (void) cmd;
+  return insert_href (st, xf, false);
+}
+
+static
+  bool
+ht_texthref (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  (void) of;
+  (void) cmd;
+  return insert_href (st, xf, true);
+}
+
+static
+  bool
+ht_url (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  IrNode link[1];
+  const char* beg = st->cmd_beg;
+  (void) cmd;
+  open_paragraph (st);
+  HtLegitLine( st, "no closing brace" )
+    getlined_olay_XFile (olay, xf, "}");
+  if (good) {
+    init_IrNode (link, IrLink);
+    link->flags |= IrQuote;
+    link->attr = ccstr_of_XFile (olay);
+    open_IrNode (of, st, link, beg);
+    put_text_IrNode (of, st, olay, false);
+    close_IrNode (of, st, link, ccstr_of_XFile (xf));
+  }
+  return good;
+}
+
+/** The target of \caturl is its two arguments joined.
+ * The link node keeps where the second one starts,
+ * since each is escaped on its own.
+ **/
+static
+  bool
+ht_caturl (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  IrNode link[1];
+  const char* beg = st->cmd_beg;
+  const ArenaMark mark = mark_Arena (st->arena);
+  const char* head = 0;
+  (void) cmd;
+  open_paragraph (st);
+  HtLegitLine( st, "no closing/open for caturl" )
+    getlined_olay_XFile (olay, xf, "}{");
+
+  HtLegit( st, "no closing brace" )
+  {
+    head = ccstr_of_XFile (olay);
+    good = getlined_olay_XFile (olay, xf, "}");
+  }
+  if (good) {
+    const char* tail = ccstr_of_XFile (olay);
+    const zuint head_sz = strlen (head);
+    const zuint tail_sz = strlen (tail);
+    char* target = (char*) take_Arena (st->arena, head_sz + tail_sz + 1);
+    memcpy (target, head, head_sz);
+    memcpy (&target[head_sz], tail, tail_sz + 1);
+    init_IrNode (link, IrLink);
+    link->attr = target;
+    link->num[0] = head_sz;
+    /* The link has no text, as the URL is only written to its target.*/
+    open_IrNode (of, st, link, beg);
+    close_IrNode (of, st, link, ccstr_of_XFile (xf));
+  }
+  release_Arena (st->arena, mark);
+  return good;
+}
+
+static
+  bool
+ht_includegraphics (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  IrNode node[1];
+  const char* beg = st->cmd_beg;
+  (void) cmd;
+  open_paragraph (st);
+  HtLegitLine( st, "no closing for includegraphics" )
+    getlined_olay_XFile (olay, xf, "}");
+
+  DoLegit( 0 )
+  {
+    init_IrNode (node, IrImage);
+    node->attr = ccstr_of_XFile (olay);
+    put_IrNode (of, st, node, beg, ccstr_of_XFile (xf));
+  }
+  return good;
+}
+
+/** Most \input files whose HTML is kept.**/
+#define MaxFragments 256
+
+static
+  void
+get_FragState (FragState* fs, const HtmlState* st)
+{
+  fs->eol = st->eol;
+  fs->inparagraph = st->inparagraph;
+  fs->end_document = st->end_document;
+  fs->list_depth = st->list_depth;
+  fs->list_item_open = st->list_item_open;
+  fs->cram = st->cram;
+  fs->nsections = st->nsections;
+  fs->nsubsections = st->nsubsections;
+}
+
+static
+  void
+set_FragState (HtmlState* st, const FragState* fs)
+{
+  st->eol = fs->eol;
+  st->inparagraph = fs->inparagraph;
+  st->end_document = fs->end_document;
+  st->list_depth = fs->list_depth;
+  st->list_item_open = fs->list_item_open;
+  st->cram = fs->cram;
+  st->nsections = fs->nsections;
+  st->nsubsections = fs->nsubsections;
+}
+
+/** Compare states, including the section counters when {sections}.**/
+static
+  bool
+eq_FragState (const FragState* a, const FragState* b, bool sections)
+{
+  if (a->eol != b->eol ||
+      a->inparagraph != b->inparagraph ||
+      a->end_document != b->end_document ||
+      a->list_depth != b->list_depth ||
+      a->list_item_open != b->list_item_open ||
+      a->cram != b->cram)
+    return false;
+  return (!sections ||
+          (a->nsections == b->nsections &&
+           a->nsubsections == b->nsubsections));
+}
+
+/** Find the HTML of the \input file at {path} that is valid in
+ * the current state.
+ * An entry whose files have changed is dropped.
+ **/
+static
+  Fragment*
+find_Fragment (HtmlState* st, const char* path)
+{
+  FragState fs[1];
+  get_FragState (fs, st);
+  for (uint i = 0; i < st->fragments.sz; ++i) {
+    Fragment* frag = &st->fragments.s[i];
+    bool fresh = true;
+    if (!eq_cstr (path, ccstr_of_AlphaTab (&frag->path)) ||
+        frag->macros != st->macros.fingerprint ||
+        (IrOn(st) && !frag->ir) ||
+        !eq_FragState (&frag->beg, fs, frag->sections))
+      continue;
+    for (uint j = 0; fresh && j < frag->deps.sz; ++j)
+      fresh = fresh_FileDep (&frag->deps.s[j]);
+    if (fresh)
+      return frag;
+    lose_Fragment (frag);
+    st->fragments.s[i--] = st->fragments.s[--st->fragments.sz];
+  }
+  return 0;
+}
+
+/** Copy the {n} bytes at {s} into {ab}.**/
+static
+  void
+init_AlphaTab_chars (AlphaTab* ab, const char* s, zuint n)
+{
+  OFile of[] = default;
+  oputn_char_OFile (of, s, n);
+  init_AlphaTab_move_OFile (ab, of);
+}
+
+/** Keep what an \input file just wrote as a Fragment.
+ * Its HTML starts at offset {out_beg} of {of},
+ * its table of contents text starts at {toc_beg},
+ * and the files it read start at {dep_beg} in {st->deps}.
+ * The nodes that it recorded are under {node}, if any.
+ **/
+static
+  void
+keep_Fragment (HtmlState* st, const Fragment* key, OFile* of,
+               zuint out_beg, zuint toc_beg, zuint dep_beg,
+               const IrNode* node)
+{
+  OFile* toc = st->toc_ofile;
+  Fragment* frag = Grow1Table( st->fragments );
+  *frag = *key;
+  get_FragState (&frag->end, st);
+  frag->sections = (key->sections ||
+                    frag->beg.nsections != frag->end.nsections ||
+                    frag->beg.nsubsections != frag->end.nsubsections ||
+                    toc_beg != toc->off);
+  frag->path = cons1_AlphaTab (ccstr_of_AlphaTab (&st->deps.s[dep_beg].path));
+  frag->html_sz = of->off - out_beg;
+  init_AlphaTab_chars (&frag->html,
+                       window2_OFile (of, out_beg, of->off).s,
+                       frag->html_sz);
+  frag->toc_sz = toc->off - toc_beg;
+  init_AlphaTab_chars (&frag->toc,
+                       window2_OFile (toc, toc_beg, toc->off).s,
+                       frag->toc_sz);
+  InitTable( frag->deps );
+  for (zuint i = dep_beg; i < st->deps.sz; ++i)
+    push_FileDep (&frag->deps, &st->deps.s[i]);
+  frag->ir = 0;
+  if (node) {
+    IrNode* root;
+    frag->ir = AllocT( Ir, 1 );
+    init_Ir (frag->ir);
+    root = (IrNode*) take_Arena (frag->ir->arena, sizeof (IrNode));
+    init_IrNode (root, IrInput);
+    frag->ir->root = root;
+    graft_Ir (frag->ir, root, st->ir, node);
+  }
+}
+
+/** Write {frag} in place of its \input file,
+ * with the same effects on the state.
+ * Its nodes go under {node}, if it is recorded.
+ **/
+static
+  void
+replay_Fragment (OFile* of, HtmlState* st, const Fragment* frag,
+                 IrNode* node)
+{
+  FragState end = frag->end;
+  oputn_char_OFile (of, ccstr_of_AlphaTab (&frag->html), frag->html_sz);
+  oputn_char_OFile (st->toc_ofile, ccstr_of_AlphaTab (&frag->toc),
+                    frag->toc_sz);
+  /* Counters were not matched when the file does not use them,
+   * so they stay as they are.
+   */
+  if (!frag->sections) {
+    end.nsections = st->nsections;
+    end.nsubsections = st->nsubsections;
+  }
+  set_FragState (st, &end);
+  if (frag->sections)
+    st->nsection_uses += 1;
+  for (i ; frag->deps.sz)
+    push_FileDep (&st->deps, &frag->deps.s[i]);
+  if (node && frag->ir)
+    graft_Ir (st->ir, node, frag->ir, frag->ir->root);
+}
+
+/** Include a file, or its HTML from the last time it was included
+ * when nothing that it depends on has changed.
+ **/
+static
+  bool
+ht_input (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  DeclLegit( good );
+  XFile olay[1];
+  InFile in[1];
+  const ArenaMark mark = mark_Arena (st->arena);
+  char* filename = 0;
+  FileDep dep[1];
+  bool regular = false;
+  Fragment* frag = 0;
+  IrNode node[1];
+  const char* beg = st->cmd_beg;
+  const double t0 = (StatsOn(st) ? now_sec () : 0);
+  (void) cmd;
+  init_InFile (in);
+  dep->path = dflt_AlphaTab ();
+  HtLegitLine( st, "no closing brace" )
+    getlined_olay_XFile (olay, xf, "}");
+
+  HtLegit( st, "Cannot open file!" )
+  {
+    const char* name = ccstr_of_XFile (olay);
+    const zuint n = strlen (name);
+    filename = (char*) take_Arena (st->arena, n + sizeof (".tex"));
+    memcpy (filename, name, n);
+    memcpy (&filename[n], ".tex", sizeof (".tex"));
+    if (st->include) {
+      good = include_InFile (in, st->include, st->include_arg, filename);
+      if (good) {
+        cat_cstr_AlphaTab (&dep->path, filename);
+        dep->sz = strlen (cstr_of_XFile (in->xf));
+      }
+    }
+    else {
+      const char* dir = st->pathname;
+      good = stat_FileDep (dep, dir, filename, &regular);
+      for (uint i = 0; i < st->search_paths.sz && !good; ++i) {
+        add_absent_dep_HtmlState (st, dir, filename);
+        dir = ccstr_of_AlphaTab (&st->search_paths.s[i]);
+        good = stat_FileDep (dep, dir, filename, &regular);
+      }
+      if (good)
+        frag = find_Fragment (st, ccstr_of_AlphaTab (&dep->path));
+      if (good && !frag)
+        good = open_InFile (in, 0, ccstr_of_AlphaTab (&dep->path));
+    }
+  }
+  if (good) {
+    init_IrNode (node, IrInput);
+    node->attr = ccstr_of_AlphaTab (&dep->path);
+    open_IrNode (of, st, node, beg);
+  }
+  if (good && frag) {
+    replay_Fragment (of, st, frag, node->kept);
+  }
+  else if (good) {
+    const char* tmp = st->pathname;
+    const TexIndex* tmp_index = st->index;
+    TexIndex idx[1];
+    Fragment key[1];
+    const bool allgood = st->allgood;
+    const uint nbogs = st->nbogs;
+    const bool show_toc = st->show_toc;
+    const zuint toc_pos = st->toc_pos;
+    const zuint out_beg = of->off;
+    const zuint toc_beg = st->toc_ofile->off;
+    const zuint dep_beg = st->deps.sz;
+    const uint nsection_uses = st->nsection_uses;
+    const uint frag_drops = st->frag_drops;
+    /* Only plain text is kept: no problems, no new macros,
+     * no table of contents, and no paragraph tags outside {of}.
+     * Its nodes must be recorded too, when the IR is.
+     */
+    const bool keepable = (regular && of == st->body_ofile &&
+                           (!st->ir || node->kept) &&
+                           st->fragments.sz < MaxFragments);
+    IrSrc src;
+
+    get_FragState (&key->beg, st);
+    key->macros = st->macros.fingerprint;
+    /* Files from an include callback are not on disk to be watched.*/
+    if (!st->include) {
+      dep->hash = text_hash_HtmlState (st, cstr_of_XFile (in->xf));
+      push_FileDep (&st->deps, dep);
+    }
+
+    init_TexIndex (idx);
+    build_TexIndex (idx, cstr_of_XFile (in->xf));
+    st->pathname = ccstr_of_AlphaTab (&in->pathname);
+    st->index = idx;
+    src = enter_Ir (st, cstr_of_XFile (in->xf), 0,
+                    ccstr_of_AlphaTab (&dep->path));
+    /* Keep the file's HTML in {of} so it can be copied,
+     * unless it grows too big for that.
+     */
+    if (keepable) {
+      if (st->frag_holds == 0)
+        st->frag_hold_beg = out_beg;
+      st->frag_holds += 1;
+    }
+    htbody (of, in->xf, st);
+    if (keepable && frag_drops == st->frag_drops)
+      st->frag_holds -= 1;
+    leave_Ir (st, &src);
+    st->pathname = tmp;
+    st->index = tmp_index;
+    lose_TexIndex (idx);
+
+    key->sections = (nsection_uses != st->nsection_uses);
+    /* The file's nodes must all end inside it,
+     * or they would not be the same where it is replayed.
+     */
+    if (keepable && frag_drops == st->frag_drops &&
+        allgood && st->allgood && nbogs == st->nbogs &&
+        key->macros == st->macros.fingerprint &&
+        show_toc == st->show_toc && toc_pos == st->toc_pos &&
+        (!st->ir || st->ir->cur == node->kept))
+      keep_Fragment (st, key, of, out_beg, toc_beg, dep_beg, node->kept);
+  }
+  else {
+    htbog (st, "Cannot find input file: ", filename);
+  }
+  if (good) {
+    close_IrNode (of, st, node, ccstr_of_XFile (xf));
+  }
+  if (good && StatsOn(st)) {
+    /* Time of nested inputs counts toward this one too.*/
+    InputStats* x = Grow1Table( st->stats->inputs );
+    x->path = dflt_AlphaTab ();
+    copy_AlphaTab (&x->path, &dep->path);
+    x->sz = dep->sz;
+    x->sec = now_sec () - t0;
+    x->cached = !!frag;
+  }
+  lose_InFile (in);
+  lose_AlphaTab (&dep->path);
+  release_Arena (st->arena, mark);
+  return good;
+}
+
+static
+  bool
+ht_end_document (OFile* of, XFile* xf, HtmlState* st, const HtCmd* cmd)
+{
+  (void) of;
+  (void) xf;
+  (void) cmd;
+  close_paragraph (st);
+  st->end_document = true;
+  return true;
+}
+
+#define HtCmdName(s)  s, sizeof(s)-1
+
+// \\  -->  <br />
+// \   -->  &nbsp;
+// \quicksec{TEXT}  -->  <b>TEXT.</b>
+// \expten{NUM}  -->  &times;10<sup>NUM</sup>
+// \textit{TEXT}  -->  <it>TEXT</it>
+// \textbf{TEXT}  -->  <b>TEXT</b>
+// \texttt{TEXT}  -->  <b>TEXT</b>
+// \underline{TEXT}  -->  <u>TEXT</u>
+// \ilcode{...}  -->  <code>...</code>
+// \ilflag{...}
+// \ilfile{...}
+// \ilsym{...}
+// \illit{...}
+// \ilname{...}
+// \ilkey{...}
+// \ttvbl{...}
+// $...$  -->  <i>...</i>
+// \begin{code}\n...\n\end{code}  -->  <pre><code>...</code></pre>
+// \begin{center}  -->  <div class="cjust">...</div>
+// \begin{tabular}  -->  <table>...</table>
+// \href{URL}{TEXT}  -->  <a href="URL">TEXT</a>
+// \url{URL}  -->  <a href="URL">URL</a>
+// \caturl{URL}  -->  <a href="URL">URL</a>
+// \includegraphics{URL}  -->  <img src="URL" />
+// \section{TEXT}  -->  <h2>TEXT</h2>
+// \subsection{TEXT}  -->  <h3>TEXT</h3>
+// \label{myname}  -->  <a name="myname">...</a>
+static const HtCmd htcmds[] =
+{
+  { HtCmdName("\\"), 0, ht_literal, "<br />", 0 },
+  { HtCmdName(" "), 0, ht_literal, "&nbsp;", 0 },
+  { HtCmdName("%"), 0, ht_literal, "%", 0 },
+  { HtCmdName("begin{itemize}"), 0, ht_open_list, "ul", 0 },
+  { HtCmdName("begin{itemize*}"), 0, ht_open_list, "ul", 0 },
+  { HtCmdName("begin{enumerate}"), 0, ht_open_list, "ol", 0 },
+  { HtCmdName("begin{enumerate*}"), 0, ht_open_list, "ol", 0 },
+  { HtCmdName("end{itemize}"), 0, ht_close_list, "ul", 0 },
+  { HtCmdName("end{itemize*}"), 0, ht_close_list, "ul", 0 },
+  { HtCmdName("end{enumerate}"), 0, ht_close_list, "ol", 0 },
+  { HtCmdName("end{enumerate*}"), 0, ht_close_list, "ol", 0 },
+  { HtCmdName("item"), 0, ht_item, 0, 0 },
+  { HtCmdName("textiff"), 0, ht_literal, "<i>iff</i>", 0 },
+  { HtCmdName("newcommand"), HtCmd_Brace, ht_newcommand, 0, 0 },
+  { HtCmdName("quicksec"), HtCmd_Brace, ht_quicksec, "<b>", ".</b>" },
+  { HtCmdName("expten"), HtCmd_Brace, ht_escaped,
+    "&times;10<sup>", "</sup>" },
+  { HtCmdName("textit"), HtCmd_Brace, ht_nested, " <i>", "</i>" },
+  { HtCmdName("textbf"), HtCmd_Brace, ht_nested, " <b>", "</b>" },
+  { HtCmdName("texttt"), HtCmd_Brace, ht_escaped,
+    " <span class=\"texttt\">", "</span>" },
+  { HtCmdName("underline"), HtCmd_Brace, ht_nested,
+    " <span class=\"underline\">", "</span>" },
+  { HtCmdName("ilcode"), HtCmd_Brace | HtCmd_Verbatim, ht_escaped,
+    "<code>", "</code>", IrInlineCode },
+  { HtCmdName("ilflag"), HtCmd_Brace, ht_escaped, "<b>", "</b>" },
+  { HtCmdName("ilfile"), HtCmd_Brace, ht_escaped, "<i>", "</i>" },
+  { HtCmdName("ilsym"), HtCmd_Brace, ht_escaped, "<b>", "</b>" },
+  { HtCmdName("illit"), HtCmd_Brace, ht_escaped, "<i>", "</i>" },
+  { HtCmdName("ilname"), HtCmd_Brace, ht_escaped, "<b>", "</b>" },
+  { HtCmdName("ilkey"), HtCmd_Brace, ht_escaped, "<b>", "</b>" },
+  { HtCmdName("ttvbl"), HtCmd_Brace, ht_escaped,
+    " <span class=\"ttvbl\">", "</span>" },
+  { HtCmdName("begin{code}"), HtCmd_Eol, ht_code, 0, 0, IrCode },
+  { HtCmdName("codeinputlisting"), HtCmd_Brace | HtCmd_Opt,
+    ht_codeinputlisting, 0, 0, IrCode },
+  { HtCmdName("begin{flushleft}"), 0, ht_align,
+    "<div class=\"ljust\">", "flushleft", IrAlign },
+  { HtCmdName("begin{center}"), 0, ht_align,
+    "<div class=\"cjust\">", "center", IrAlign },
+  { HtCmdName("begin{flushright}"), 0, ht_align,
+    "<div class=\"rjust\">", "flushright", IrAlign },
+  { HtCmdName("begin{tabular}"), HtCmd_Brace, ht_tabular, 0, 0, IrTable },
+  { HtCmdName("tableofcontents"), 0, ht_tableofcontents, 0, 0 },
+  { HtCmdName("section"), HtCmd_Brace, ht_section, 0, 0 },
+  { HtCmdName("subsection"), HtCmd_Brace, ht_subsection, 0, 0 },
+  { HtCmdName("label"), HtCmd_Brace, ht_label, 0, 0 },
+  { HtCmdName("href"), HtCmd_Brace | HtCmd_Inline, ht_href, 0, 0 },
+  { HtCmdName("texthref"), HtCmd_Brace | HtCmd_Inline, ht_texthref, 0, 0 },
+  { HtCmdName("url"), HtCmd_Brace | HtCmd_Inline, ht_url, 0, 0 },
+  { HtCmdName("caturl"), HtCmd_Brace | HtCmd_Inline, ht_caturl, 0, 0 },
+  { HtCmdName("includegraphics"), HtCmd_Brace | HtCmd_Inline,
+    ht_includegraphics, 0, 0 },
+  { HtCmdName("input"), HtCmd_Brace, ht_input, 0, 0 },
+  { HtCmdName("end{document}"), 0, ht_end_document, 0, 0 },
+};
+#undef HtCmdName
+
+/** Write the {n} bytes of a target at {s} as an attribute value.
+ * Its macros are expanded but not recorded, since the target
+ * is an attribute of its node.
+ **/
+static
+  void
+oput_target_IrNode (OFile* of, HtmlState* st, const char* s, zuint n)
+{
+  const ArenaMark mark = mark_Arena (st->arena);
+  AlphaTab tmp = dflt_AlphaTab ();
+  XFile olay[1];
+  IrNode* ir_cur = pause_Ir (st);
+  tmp.s = dup_Arena (st->arena, s, n);
+  tmp.sz = n + 1;
+  init_XFile_olay_AlphaTab (olay, &tmp);
+  escape_attr_for_html (of, olay, st);
+  resume_Ir (st, ir_cur);
+  release_Arena (st->arena, mark);
+}
+
+/** Write the HTML that opens {node}.**/
+static
+  void
+oput_open_IrNode (OFile* of, HtmlState* st, const IrNode* node)
+{
+  const char* cram = ((node->flags & IrCram) ? " class=\"cram\"" : "");
+  switch (node->kind) {
+  case IrParagraph:
+    printf_OFile (of, "\n<p%s>", cram);
+    break;
+  case IrList:
+    printf_OFile (of, "<%s%s>", node->attr, cram);
+    break;
+  case IrItem:
+    oput_cstr_OFile (of, "<li>");
+    break;
+  case IrSection:
+  case IrSubsection:
+    printf_OFile (of, "\n<%s id=\"", node->kind == IrSection ? "h2" : "h3");
+    oput_cstr_OFile (of, node->attr);
+    printf_OFile (of, "\">%u.", node->num[0]);
+    if (node->kind == IrSubsection)
+      printf_OFile (of, "%u.", node->num[1]);
+    oput_char_OFile (of, ' ');
+    break;
+  case IrTable:
+    oput_cstr_OFile (of, "\n<table>");
+    break;
+  case IrRow:
+    if (node->flags & IrHline)
+      oput_cstr_OFile (of, "\n<tr class=\"hline\">");
+    else
+      oput_cstr_OFile (of, "\n<tr>");
+    break;
+  case IrCell:
+    oput_cstr_OFile (of, td_tag(node->num[0]));
+    break;
+  case IrCode:
+    printf_OFile (of, "\n<pre%s><code>", cram);
+    break;
+  case IrInlineCode:
+  case IrCommand:
+  case IrAlign:
+    if (node->cmd->open)
+      oput_cstr_OFile (of, node->cmd->open);
+    break;
+  case IrLink:
+    if (node->flags & IrQuote) {
+      oput_cstr_OFile (of, "<a href='");
+      oput_target_IrNode (of, st, node->attr, strlen (node->attr));
+      oput_cstr_OFile (of, "'>");
+      break;
+    }
+    oput_cstr_OFile (of, "<a ");
+    if (node->flags & IrBlack)
+      oput_cstr_OFile (of, "class=\"texturl\" ");
+    oput_cstr_OFile (of, "href=\"");
+    if (node->num[0] > 0) {
+      oput_target_IrNode (of, st, node->attr, node->num[0]);
+      oput_target_IrNode (of, st, &node->attr[node->num[0]],
+                          strlen (&node->attr[node->num[0]]));
+    }
+    else {
+      oput_target_IrNode (of, st, node->attr, strlen (node->attr));
+    }
+    oput_cstr_OFile (of, "\">");
+    break;
+  case IrImage:
+    oput_cstr_OFile (of, "<img src=\"");
+    oput_target_IrNode (of, st, node->attr, strlen (node->attr));
+    oput_cstr_OFile (of, "\" />");
+    break;
+  case IrMath:
+    oput_cstr_OFile (of, "<i>");
+    break;
+  case IrLabel:
+    oput_uint_OFile (of, node->num[0]);
+    oput_cstr_OFile (of, "<a name=\"");
+    oput_cstr_OFile (of, node->attr);
+    oput_cstr_OFile (of, "\"></a>");
+    break;
+  case IrDash:
+    oput_cstr_OFile (of, node->num[0] == 2 ? "&ndash;" : "-");
+    break;
+  default:
+    /* Macros, \input files and text write their content themselves.*/
+    break;
+  }
+}
+
+/** Write the HTML that closes {node}.**/
+static
+  void
+oput_close_IrNode (OFile* of, HtmlState* st, const IrNode* node)
+{
+  (void) st;
+  switch (node->kind) {
+  case IrParagraph:
+    oput_cstr_OFile (of, "</p>");
+    break;
+  case IrList:
+    printf_OFile (of, "</%s>", node->attr);
+    break;
+  case IrItem:
+    oput_cstr_OFile (of, "</li>\n");
+    break;
+  case IrSection:
+    oput_cstr_OFile (of, "</h2>");
+    break;
+  case IrSubsection:
+    oput_cstr_OFile (of, "</h3>");
+    break;
+  case IrTable:
+    oput_cstr_OFile (of, "\n</table>");
+    break;
+  case IrRow:
+    oput_cstr_OFile (of, "\n</tr>");
+    break;
+  case IrCell:
+    oput_cstr_OFile (of, "</td>");
+    break;
+  case IrCode:
+    oput_cstr_OFile (of, "</code></pre>");
+    break;
+  case IrInlineCode:
+  case IrCommand:
+    if (node->cmd->close)
+      oput_cstr_OFile (of, node->cmd->close);
+    break;
+  case IrAlign:
+    oput_cstr_OFile (of, "</div>");
+    break;
+  case IrLink:
+    oput_cstr_OFile (of, "</a>");
+    break;
+  case IrMath:
+    oput_cstr_OFile (of, "</i>");
+    break;
+  default:
+    break;
+  }
+}
+
+/** Write the table of contents entry that opens the section {node}.**/
+static
+  void
+oput_toc_open_IrNode (OFile* toc, const IrNode* node)
+{
+  if (node->flags & IrEndSubs)
+    oput_cstr_OFile (toc, "</li></ol>");
+  if (node->num[0] == 1 && node->num[1] == 0)
+    oput_cstr_OFile (toc, "\n<ol class=\"cram\">");
+  else if (node->num[1] == 1)
+    oput_cstr_OFile (toc, "\n<ol>");
+  else
+    oput_cstr_OFile (toc, "</li>");
+
+  oput_cstr_OFile (toc, "\n<li><a href=\"#");
+  oput_cstr_OFile (toc, node->attr);
+  oput_cstr_OFile (toc, "\">");
+}
+
+static
+  void
+oput_toc_close_IrNode (OFile* toc, const IrNode* node)
+{
+  (void) node;
+  oput_cstr_OFile (toc, "</a>");
+}
+
+/** Write {n} bytes of {s} escaped for a JSON string.**/
+static
+  void
+oput_json_chars (OFile* of, const char* s, zuint n)
+{
+  for (i ; n) {
+    const byte c = (byte) s[i];
+    if (c == '"' || c == '\\') {
+      oput_char_OFile (of, '\\');
+      oput_char_OFile (of, (char) c);
+    }
+    else if (c < 0x20) {
+      printf_OFile (of, "\\u%04x", (uint) c);
+    }
+    else {
+      oput_char_OFile (of, (char) c);
+    }
+  }
+}
+
+static
+  void
+oput_json_string (OFile* of, const char* s)
+{
+  oput_char_OFile (of, '"');
+  oput_json_chars (of, s, strlen (s));
+  oput_char_OFile (of, '"');
+}
+
+/** Write the -stats of one document as a JSON object.
+ * Only commands that were used are listed.
+ **/
+static
+  void
+oput_json_DocStats (OFile* of, const DocStats* ds, const char* name)
+{
+  bool first = true;
+  oput_cstr_OFile (of, "{\"document\":");
+  oput_json_string (of, name);
+  printf_OFile (of, ",\"input_bytes\":%lu", (unsigned long) ds->input_sz);
+  printf_OFile (of, ",\"cache_hit\":%s", ds->cache_hit ? "true" : "false");
+  printf_OFile (of, ",\"head_seconds\":%.6f", ds->head_sec);
+  printf_OFile (of, ",\"body_seconds\":%.6f", ds->body_sec);
+  printf_OFile (of, ",\"foot_seconds\":%.6f", ds->foot_sec);
+  printf_OFile (of, ",\"macro_hits\":%lu", (unsigned long) ds->nmacro_hits);
+  printf_OFile (of, ",\"macro_misses\":%lu",
+                (unsigned long) ds->nmacro_misses);
+  printf_OFile (of, ",\"escape_bytes\":%lu", (unsigned long) ds->escape_sz);
+  printf_OFile (of, ",\"peak_body_bytes\":%lu",
+                (unsigned long) ds->peak_body_sz);
+  printf_OFile (of, ",\"peak_toc_bytes\":%lu",
+                (unsigned long) ds->peak_toc_sz);
+  if (Tex2WebCountAllocs)
+    printf_OFile (of, ",\"allocs\":%lu", (unsigned long) ds->nallocs);
+
+  oput_cstr_OFile (of, ",\"commands\":{");
+  for (i ; ds->ncmds_sz) {
+    if (ds->ncmds[i] == 0)
+      continue;
+    if (!first)
+      oput_char_OFile (of, ',');
+    first = false;
+    oput_cstr_OFile (of, "\"\\\\");
+    oput_json_chars (of, htcmds[i].name, htcmds[i].name_sz);
+    oput_char_OFile (of, '"');
+    printf_OFile (of, ":%lu", (unsigned long) ds->ncmds[i]);
+  }
+  oput_cstr_OFile (of, "},\"inputs\":[");
+  for (i ; ds->inputs.sz) {
+    const InputStats* x = &ds->inputs.s[i];
+    if (i > 0)
+      oput_char_OFile (of, ',');
+    oput_cstr_OFile (of, "{\"path\":");
+    oput_json_string (of, ccstr_of_AlphaTab (&x->path));
+    printf_OFile (of, ",\"bytes\":%lu,\"seconds\":%.6f,\"cached\":%s}",
+                  (unsigned long) x->sz, x->sec,
+                  x->cached ? "true" : "false");
+  }
+  oput_cstr_OFile (of, "]}");
+}
+
+/** Write {node} and the nodes inside it as a JSON object.
+ * A node without a span of its own, like a paragraph,
+ * spans its children when they are in the same file.
+ **/
+static
+  void
+oput_json_IrNode (OFile* of, const IrNode* node)
+{
+  zuint beg = node->beg;
+  zuint end = node->end;
+  if (beg == IrNoPos && node->child && node->child->file == node->file)
+    beg = node->child->beg;
+  if (end == IrNoPos && node->last && node->last->file == node->file)
+    end = node->last->end;
+
+  printf_OFile (of, "{\"kind\":\"%s\",\"file\":%u",
+                ir_kind_names[node->kind], node->file);
+  if (beg != IrNoPos)
+    printf_OFile (of, ",\"beg\":%lu", (unsigned long) beg);
+  if (end != IrNoPos)
+    printf_OFile (of, ",\"end\":%lu", (unsigned long) end);
+  if (node->attr) {
+    oput_cstr_OFile (of, ",\"attr\":");
+    oput_json_string (of, node->attr);
+  }
+  if (node->child) {
+    oput_cstr_OFile (of, ",\"children\":[");
+    for (const IrNode* x = node->child; x; x = x->next) {
+      if (x != node->child)
+        oput_char_OFile (of, ',');
+      oput_json_IrNode (of, x);
+    }
+    oput_char_OFile (of, ']');
+  }
+  oput_char_OFile (of, '}');
+}
+
+/** Write the IR of the document as JSON to {st->sink},
+ * and to the render cache entry if there is one.
+ * Spans are byte offsets into the files listed first.
+ **/
+static
+  void
+emit_ir_HtmlState (HtmlState* st)
+{
+  const Ir* ir = st->ir;
+  OFile of[] = default;
+  struct iovec segs[1];
+  oput_cstr_OFile (of, "{\"files\":[");
+  for (i ; ir->files.sz) {
+    if (i > 0)
+      oput_char_OFile (of, ',');
+    oput_json_string (of, ccstr_of_AlphaTab (&ir->files.s[i]));
+  }
+  oput_cstr_OFile (of, "],\"root\":");
+  oput_json_IrNode (of, ir->root);
+  oput_cstr_OFile (of, "}\n");
+  segs[0].iov_base = window2_OFile (of, 0, of->off).s;
+  segs[0].iov_len = of->off;
+  writev_OSink (st->sink, segs, 1);
+  if (st->cache_writer)
+    writev_RCacheWriter (st->cache_writer, segs, 1);
+  lose_OFile (of);
+}
+
+/** Fill the open-addressed index into {htcmds}.
+ * Each slot holds one plus the command's index, or zero when empty.
+ **/
+static
+  void
+init_htcmd_slots (byte* slots)
+{
+  const uint mask = NHtCmdSlots - 1;
+  memset (slots, 0, NHtCmdSlots);
+  for (uint i = 0; i < ArraySz(htcmds); ++i) {
+    uint h = hash_chars (htcmds[i].name, htcmds[i].name_sz) & mask;
+    while (slots[h] != 0)
+      h = (h + 1) & mask;
+    slots[h] = (byte) (i + 1);
+  }
+}
+
+static
+  const HtCmd*
+lookup_htcmd (const byte* slots, const char* s, uint n)
+{
+  const uint mask = NHtCmdSlots - 1;
+  uint h = hash_chars (s, n) & mask;
+  while (slots[h] != 0) {
+    const HtCmd* cmd = &htcmds[slots[h] - 1];
+    if (cmd->name_sz == n && 0 == memcmp (cmd->name, s, n))
+      return cmd;
+    h = (h + 1) & mask;
+  }
+  return 0;
+}
+
+static inline
+  bool
+alpha_ck_char (char c)
+{
+  return (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z'));
+}
+
+/** Handle the command that follows a backslash.
+ *
+ * The name is read once and looked up in {htcmds}.
+ * Anything not found there is treated as a macro.
+ **/
+static
+  bool
+htcmd (OFile* of, XFile* xf, HtmlState* st, bool pending_newline)
+{
+  const char* s = ccstr_of_XFile (xf);
+  const HtCmd* cmd;
+  uint n = 0;
+
+  if (alpha_ck_char (s[0])) {
+    while (alpha_ck_char (s[n]))
+      ++ n;
+    if (s[n] == '{' &&
+        ((n == 5 && 0 == memcmp (s, "begin", 5)) ||
+         (n == 3 && 0 == memcmp (s, "end", 3))))
+    {
+      uint m = n + 1;
+      while (alpha_ck_char (s[m]) || s[m] == '*')
+        ++ m;
+      if (s[m] == '}')
+        n = m + 1;
+    }
+  }
+  else if (s[0] != '\0') {
+    n = 1;
+  }
+
+  cmd = lookup_htcmd (st->htcmd_slots, s, n);
+  if (cmd) {
+    if ((cmd->flags & HtCmd_Brace) && s[n] != '{' &&
+        !((cmd->flags & HtCmd_Opt) && s[n] == '['))
+      cmd = 0;
+    else if ((cmd->flags & HtCmd_Eol) && s[n] != '\n')
+      cmd = 0;
+  }
+  if (!cmd) {
+    handle_macro (of, xf, st, HtmlEscText);
+    return true;
+  }
+
+  if (StatsOn(st))
+    st->stats->ncmds[cmd - htcmds] += 1;
+  if ((cmd->flags & (HtCmd_Brace | HtCmd_Eol)) && !(cmd->flags & HtCmd_Opt))
+    ++ n;
+  offto_XFile (xf, &s[n]);
+
+  if ((cmd->flags & HtCmd_Inline) && pending_newline)
+    oput_char_OFile (of, '\n');
+  /* Where the command's node starts, for its handler.*/
+  st->cmd_beg = &s[-1];
+  return cmd->fn (of, xf, st, cmd);
+}
+
+  bool
+htbody (OFile* of, XFile* xf, HtmlState* st)
+{
+  DeclLegit( good );
+
+  if (too_deep_HtmlState (st)) {
+    htbog (st, "Commands nest too deeply", 0);
+    st->allgood = false;
+    return false;
+  }
+  ++ st->body_depth;
+
+  while (good && !st->end_document)
+  {
+    XFile olay[1];
+    char match = 0;
+    bool pending_newline;
+    if (!nextstop_olay_TexIndex (st->index, olay, xf, &match))
+      break;
+
+    //skipds_XFile (olay, WhiteSpaceChars);
+    if (eq_cstr ("", ccstr_of_XFile (olay)))
+    {
+      if (match == '\n' && st->eol) {
+        close_paragraph (st);
+        st->cram = false;
+      }
+    }
+    else
+    {
+      open_paragraph (st);
+      if (st->eol) {
+        oput_cstr_OFile (of, "\n");
+        st->eol = false;
+      }
+      put_text_IrNode (of, st, olay, false);
+    }
+
+    pending_newline = (st->eol && st->inparagraph);
+    st->eol = false;
+
+    if (!good) {
+    }
+    else if (match == '\n') {
+      st->eol = true;
+    }
+    else if (match == '%') {
+      st->eol = true;
+      getline_XFile (xf);
+    }
+    else if (match == '$') {
+      IrNode math[1];
+      const char* beg = &ccstr_of_XFile (xf)[-1];
+      open_paragraph (st);
+      HtLegitLine( st, "no closing dollar sign" )
+        getlined_olay_XFile (olay, xf, "$");
+      if (good) {
+        init_IrNode (math, IrMath);
+        open_IrNode (of, st, math, beg);
+        put_text_IrNode (of, st, olay, false);
+        close_IrNode (of, st, math, ccstr_of_XFile (xf));
+      }
+    }
+    else if (match == '-') {
+      IrNode dash[1];
+      const char* beg = &ccstr_of_XFile (xf)[-1];
+      if (pending_newline)
+        oput_char_OFile (of, '\n');
+      init_IrNode (dash, IrDash);
+      dash->num[0] = (skip_cstr_XFile (xf, "-") ? 2 : 1);
+      put_IrNode (of, st, dash, beg, ccstr_of_XFile (xf));
+    }
+    else if (match == '\\') {
+      good = htcmd (of, xf, st, pending_newline);
+    }
+
+    if (flush_ck_HtmlState (st, of))
+      flush_body_HtmlState (st);
+  }
+
+  -- st->body_depth;
+  st->allgood = st->allgood && good;
+  return good;
+}
+
+/** Environments that are parsed whole.**/
+static const char* const whole_envs[] =
+{
+  "tabular", "flushleft", "center", "flushright"
+};
+
+/** Whether {s} names an environment in {whole_envs} followed by '}'.**/
+static
+  bool
+whole_env_ck (const char* s)
+{
+  for (i ; ArraySz(whole_envs)) {
+    const zuint n = strlen (whole_envs[i]);
+    if (0 == strncmp (s, whole_envs[i], n) && s[n] == '}')
+      return true;
+  }
+  return false;
+}
+
+/** Like whole_env_ck(), for a \begin or \end that starts a line
+ * when {line_start}. Tables only nest by lines that start with them,
+ * as getenv_olay_TexIndex() reads them.
+ **/
+static
+  bool
+whole_env_line_ck (const char* s, bool line_start)
+{
+  return (whole_env_ck (s) &&
+          (line_start || 0 != strncmp (s, "tabular}", 8)));
+}
+
+/** A run of sections of one document, rendered on its own.
+ *
+ * It starts at a \section or \subsection at the start of a line,
+ * outside of any braces, math, list, code or other environment
+ * that must be parsed whole.
+ **/
+typedef struct SectionTask SectionTask;
+struct SectionTask
+{
+  /** Text of the run, which ends where the next one starts.**/
+  const char* text;
+  zuint text_sz;
+  /** Length of {SectionDoc.defs} before the run.**/
+  zuint defs_sz;
+  /** State that the run is assumed to start in, and the state it ends in.**/
+  FragState beg;
+  FragState end;
+  /** Fingerprints of the macros at the start and end of the run.**/
+  uint64_t beg_macros;
+  uint64_t end_macros;
+  OFile body[1];
+  OFile toc[1];
+  OFile err[1];
+  TableT(FileDep) deps;
+  /** Nodes of the run, when the IR is recorded.**/
+  Ir* ir;
+  bool show_toc;
+  zuint toc_pos;
+  uint nbogs;
+  bool good;
+};
+DeclTableT( SectionTask, SectionTask );
+
+/** A document whose sections are rendered on several threads.**/
+typedef struct SectionDoc SectionDoc;
+struct SectionDoc
+{
+  /** State after the head, which every run copies.**/
+  HtmlState* proto;
+  /** Body \newcommand definitions, one per line.**/
+  OFile defs[1];
+  TableT(SectionTask) tasks;
+  uint next_task;
+  pthread_mutex_t lock;
+};
+
+static
+  void
+init_SectionDoc (SectionDoc* doc, HtmlState* proto)
+{
+  doc->proto = proto;
+  init_OFile (doc->defs);
+  InitTable( doc->tasks );
+  doc->next_task = 0;
+  pthread_mutex_init (&doc->lock, 0);
+}
+
+static
+  void
+lose_SectionDoc (SectionDoc* doc)
+{
+  for (i ; doc->tasks.sz) {
+    SectionTask* task = &doc->tasks.s[i];
+    lose_OFile (task->body);
+    lose_OFile (task->toc);
+    lose_OFile (task->err);
+    for (j ; task->deps.sz)
+      lose_AlphaTab (&task->deps.s[j].path);
+    LoseTable( task->deps );
+    if (task->ir) {
+      lose_Ir (task->ir);
+      free (task->ir);
+    }
+  }
+  LoseTable( doc->tasks );
+  lose_OFile (doc->defs);
+  pthread_mutex_destroy (&doc->lock);
+}
+
+/** Start a run at {text} that is assumed to begin in the state {fs}.**/
+static
+  void
+add_SectionTask (SectionDoc* doc, const char* text, const FragState* fs)
+{
+  SectionTask* task;
+  if (doc->tasks.sz > 0) {
+    SectionTask* prev = &doc->tasks.s[doc->tasks.sz-1];
+    prev->text_sz = (zuint) (text - prev->text);
+  }
+  task = Grow1Table( doc->tasks );
+  task->text = text;
+  task->text_sz = strlen (text);
+  task->defs_sz = doc->defs->off;
+  task->beg = *fs;
+  task->end = *fs;
+  task->beg_macros = 0;
+  task->end_macros = 0;
+  init_OFile (task->body);
+  init_OFile (task->toc);
+  init_OFile (task->err);
+  InitTable( task->deps );
+  task->ir = 0;
+  task->show_toc = false;
+  task->toc_pos = 0;
+  task->nbogs = 0;
+  task->good = true;
+}
+
+/** Skip the group that starts with the '{' at {p}.
+ * Return the text after it, or null when it does not end.
+ **/
+static
+  const char*
+skip_group_cstr (const char* p)
+{
+  uint depth = 0;
+  for (; *p; ++p) {
+    if (*p == '\\' && p[1] != '\0')
+      ++ p;
+    else if (*p == '{')
+      ++ depth;
+    else if (*p == '}' && --depth == 0)
+      return &p[1];
+  }
+  return 0;
+}
+
+/** Find where the body {s} can be split into runs of sections,
+ * along with the section numbers and body macros at each run.
+ * This only looks at each byte once and does not write to {s}.
+ **/
+static
+  void
+split_SectionDoc (SectionDoc* doc, const char* s)
+{
+  uint depth = 0;
+  uint nenvs = 0;
+  uint nlists = 0;
+  bool math = false;
+  FragState fs[1];
+  get_FragState (fs, doc->proto);
+  add_SectionTask (doc, s, fs);
+
+  for (const char* p = s; *p; ++p) {
+    const char c = *p;
+    const char* t = &p[1];
+    if (c == '%') {
+      p = strchr (p, '\n');
+      if (!p)  break;
+    }
+    else if (c == '{') {
+      depth += 1;
+    }
+    else if (c == '}') {
+      if (depth > 0)
+        depth -= 1;
+    }
+    else if (c == '$') {
+      if (depth == 0)
+        math = !math;
+    }
+    else if (c != '\\') {
+    }
+    else if (0 == strncmp (t, "begin{code}", 11)) {
+      p = strstr (t, "\n\\end{code}");
+      if (!p)  break;
+      p = &p[10];
+    }
+    else if (0 == strncmp (t, "end{document}", 13)) {
+      break;
+    }
+    else if (0 == strncmp (t, "newcommand{", 11)) {
+      const char* e = skip_group_cstr (&t[10]);
+      if (e && *e == '[') {
+        e = strchr (e, ']');
+        if (e)  ++ e;
+      }
+      e = ((e && *e == '{') ? skip_group_cstr (e) : 0);
+      /* A broken definition is left to be reported by the run.*/
+      if (!e)  break;
+      oputn_char_OFile (doc->defs, p, (zuint) (e - p));
+      oput_char_OFile (doc->defs, '\n');
+      p = &e[-1];
+    }
+    else {
+      const bool sec = (0 == strncmp (t, "section{", 8));
+      const bool subsec = (0 == strncmp (t, "subsection{", 11));
+      if (0 == strncmp (t, "begin{itemize", 13) ||
+          0 == strncmp (t, "begin{enumerate", 15))
+        nlists += 1;
+      else if ((0 == strncmp (t, "end{itemize", 11) ||
+                0 == strncmp (t, "end{enumerate", 13)) && nlists > 0)
+        nlists -= 1;
+      else if (0 == strncmp (t, "begin{", 6) &&
+               whole_env_line_ck (&t[6], p == s || p[-1] == '\n'))
+        nenvs += 1;
+      else if (0 == strncmp (t, "end{", 4) &&
+               whole_env_line_ck (&t[4], p == s || p[-1] == '\n') &&
+               nenvs > 0)
+        nenvs -= 1;
+
+      if ((sec || subsec) && p > s && p[-1] == '\n' &&
+          depth == 0 && nenvs == 0 && nlists == 0 && !math)
+      {
+        /* As after a line of text, with the paragraph closed.*/
+        fs->eol = true;
+        fs->inparagraph = false;
+        fs->list_depth = 0;
+        fs->list_item_open = false;
+        fs->cram = false;
+        add_SectionTask (doc, p, fs);
+      }
+      if (sec) {
+        fs->nsections += 1;
+        fs->nsubsections = 0;
+      }
+      else if (subsec) {
+        fs->nsubsections += 1;
+      }
+      if (*t)
+        ++ p;
+    }
+  }
+}
+
+/** Render {task} with the state {st}, which is reset for it.**/
+static
+  void
+render_SectionTask (HtmlState* st, SectionDoc* doc, SectionTask* task)
+{
+  const bool last = (task == &doc->tasks.s[doc->tasks.sz-1]);
+  OSink sink[1];
+  AlphaTab ab = dflt_AlphaTab ();
+  XFile xf[1];
+  TexIndex idx[1];
+
+  init_count_OSink (sink);
+  reset_HtmlState (st, doc->proto, sink);
+  st->errfile = task->err;
+  st->pathname = doc->proto->pathname;
+  st->hold_flush = 1;
+  if (task->defs_sz > 0) {
+    ab.s = AllocT( char, task->defs_sz + 1 );
+    ab.sz = task->defs_sz + 1;
+    memcpy (ab.s, window2_OFile (doc->defs, 0, task->defs_sz).s,
+            task->defs_sz);
+    ab.s[task->defs_sz] = '\0';
+    init_XFile_olay_AlphaTab (xf, &ab);
+    parse_newcommands (st, xf);
+    free (ab.s);
+  }
+  task->beg_macros = st->macros.fingerprint;
+  set_FragState (st, &task->beg);
+
+  /* Parsing writes into the text, so each run works on its own copy.*/
+  ab.s = AllocT( char, task->text_sz + 1 );
+  ab.sz = task->text_sz + 1;
+  memcpy (ab.s, task->text, task->text_sz);
+  ab.s[task->text_sz] = '\0';
+  init_XFile_olay_AlphaTab (xf, &ab);
+  init_TexIndex (idx);
+  build_TexIndex (idx, cstr_of_XFile (xf));
+  st->index = idx;
+  st->ir = 0;
+  if (doc->proto->ir) {
+    /* Spans are measured in the whole document, as in a serial run.*/
+    if (!task->ir) {
+      task->ir = AllocT( Ir, 1 );
+      init_Ir (task->ir);
+    }
+    task->ir->name = doc->proto->ir->name;
+    begin_Ir (task->ir, ab.s);
+    task->ir->src.shift = pos_Ir (doc->proto->ir, task->text);
+    task->ir->cur = task->ir->root;
+    st->ir = task->ir;
+  }
+  task->good = htbody (st->body_ofile, xf, st);
+  st->index = 0;
+  lose_TexIndex (idx);
+
+  /* The next run starts with a section, which would close the paragraph.*/
+  if (!last)
+    close_paragraph (st);
+  if (st->ir) {
+    st->ir->cur = 0;
+    st->ir = 0;
+  }
+  free (ab.s);
+  get_FragState (&task->end, st);
+  task->end_macros = st->macros.fingerprint;
+  task->good = task->good && st->allgood;
+  task->nbogs = st->nbogs;
+  task->show_toc = st->show_toc;
+  task->toc_pos = st->toc_pos;
+  lose_OFile (task->body);
+  lose_OFile (task->toc);
+  *task->body = *st->body_ofile;
+  *task->toc = *st->toc_ofile;
+  init_OFile (st->body_ofile);
+  init_OFile (st->toc_ofile);
+  for (i ; task->deps.sz)
+    lose_AlphaTab (&task->deps.s[i].path);
+  task->deps.sz = 0;
+  for (i ; st->deps.sz)
+    push_FileDep (&task->deps, &st->deps.s[i]);
+}
+
+/** A thread that renders runs of a SectionDoc.**/
+typedef struct SectionWorker SectionWorker;
+struct SectionWorker
+{
+  SectionDoc* doc;
+  HtmlState st[1];
+  pthread_t thread;
+};
+
+static
+  void*
+section_worker (void* arg)
+{
+  SectionWorker* worker = (SectionWorker*) arg;
+  SectionDoc* doc = worker->doc;
+  for (;;) {
+    SectionTask* task = 0;
+    pthread_mutex_lock (&doc->lock);
+    if (doc->next_task < doc->tasks.sz)
+      task = &doc->tasks.s[doc->next_task++];
+    pthread_mutex_unlock (&doc->lock);
+    if (!task)  break;
+    render_SectionTask (worker->st, doc, task);
+  }
+  return 0;
+}
+
+/** Add the output of {task} to the document in {st}.**/
+static
+  void
+join_SectionTask (HtmlState* st, SectionTask* task)
+{
+  OFile* body = st->body_ofile;
+  zuint beg = 0;
+  if (task->show_toc) {
+    /* As in ht_tableofcontents().*/
+    oputn_char_OFile (body, window2_OFile (task->body, 0, task->toc_pos).s,
+                      task->toc_pos);
+    st->show_toc = false;
+    flush_body_HtmlState (st);
+    st->show_toc = true;
+    st->toc_pos = body->off;
+    beg = task->toc_pos;
+  }
+  oputn_char_OFile (body, window2_OFile (task->body, beg, task->body->off).s,
+                    task->body->off - beg);
+  oputn_char_OFile (st->toc_ofile,
+                    window2_OFile (task->toc, 0, task->toc->off).s,
+                    task->toc->off);
+  oputn_char_OFile (st->errfile,
+                    window2_OFile (task->err, 0, task->err->off).s,
+                    task->err->off);
+  for (i ; task->deps.sz)
+    push_FileDep (&st->deps, &task->deps.s[i]);
+  if (st->ir && task->ir)
+    graft_Ir (st->ir, st->ir->cur, task->ir, task->ir->root);
+  set_FragState (st, &task->end);
+  st->nbogs += task->nbogs;
+  st->allgood = st->allgood && task->good;
+  if (body->off >= BodyFlushSz)
+    flush_body_HtmlState (st);
+}
+
+/** Render the body of the document in {xf} with {st->nthreads} threads,
+ * one run of sections at a time, and join the runs in order.
+ *
+ * Each run is assumed to start in the state that split_SectionDoc()
+ * guessed for it. A run whose guess does not match where the run before
+ * it ended is rendered again with the right state. When the macros
+ * differ or a run has a problem, the whole body is rendered serially,
+ * so the HTML and messages are always those of htbody().
+ **/
+static
+  bool
+htsections (HtmlState* st, XFile* xf)
+{
+  DeclLegit( good );
+  SectionDoc doc[1];
+  SectionWorker* workers;
+  uint nworkers = st->nthreads;
+  uint nstarted = 1;
+  uint ntasks;
+  bool serial = false;
+
+  init_SectionDoc (doc, st);
+  split_SectionDoc (doc, ccstr_of_XFile (xf));
+  ntasks = doc->tasks.sz;
+  if (nworkers > ntasks)
+    nworkers = ntasks;
+  serial = (nworkers < 2);
+
+  if (!serial) {
+    workers = AllocT( SectionWorker, nworkers );
+    for (i ; nworkers) {
+      workers[i].doc = doc;
+      init_worker_HtmlState (workers[i].st, st);
+    }
+    /* As in -batch, the calling thread is the first worker,
+     * so a thread that cannot be started only leaves more runs
+     * for the others.
+     */
+    while (nstarted < nworkers &&
+           0 == pthread_create (&workers[nstarted].thread, 0,
+                                section_worker, &workers[nstarted]))
+      ++ nstarted;
+    section_worker (&workers[0]);
+    for (uint i = 1; i < nstarted; ++i)
+      pthread_join (workers[i].thread, 0);
+
+    for (i ; ntasks) {
+      SectionTask* task = &doc->tasks.s[i];
+      if (i > 0) {
+        const SectionTask* prev = &doc->tasks.s[i-1];
+        if (prev->end.end_document) {
+          ntasks = i;
+          break;
+        }
+        if (task->beg_macros != prev->end_macros) {
+          serial = true;
+          break;
+        }
+        if (!eq_FragState (&task->beg, &prev->end, true)) {
+          task->beg = prev->end;
+          render_SectionTask (workers[0].st, doc, task);
+        }
+      }
+      if (!task->good || task->nbogs > 0) {
+        serial = true;
+        break;
+      }
+    }
+    for (i ; nworkers)
+      lose_HtmlState (workers[i].st);
+    free (workers);
+  }
+
+  if (!serial) {
+    for (i ; ntasks)
+      join_SectionTask (st, &doc->tasks.s[i]);
+    good = st->allgood;
+  }
+  else {
+    TexIndex idx[1];
+    init_TexIndex (idx);
+    build_TexIndex (idx, cstr_of_XFile (xf));
+    st->index = idx;
+    good = htbody (st->body_ofile, xf, st);
+    st->index = 0;
+    lose_TexIndex (idx);
+  }
+  lose_SectionDoc (doc);
+  return good;
+}
+
+/** Version of tex2web that keys the render cache.
+ * Unless the build sets it, each build has its own.
+ **/
+#ifndef Tex2WebVersion
+#define Tex2WebVersion __DATE__ " " __TIME__
+#endif
+
+/** Hash everything that decides the HTML of the document {text},
+ * except for the files that it reads.
+ **/
+static
+  uint64_t
+render_key_HtmlState (const HtmlState* st, const char* text)
+{
+  const char* css = ccstr_of_AlphaTab (&st->css_filepath);
+  const char* dir = (st->pathname ? st->pathname : "");
+  uint64_t h = hash_RCache (0, Tex2WebVersion, strlen (Tex2WebVersion));
+  h = hash_RCache (h, text, strlen (text));
+  h = hash_RCache (h, &st->macros.fingerprint,
+                   sizeof (st->macros.fingerprint));
+  h = hash_RCache (h, css, strlen (css));
+  h = hash_RCache (h, dir, strlen (dir));
+  for (i ; st->search_paths.sz) {
+    const char* path = ccstr_of_AlphaTab (&st->search_paths.s[i]);
+    h = hash_RCache (h, path, strlen (path));
+  }
+  if (st->ir) {
+    /* The IR is kept in place of the HTML, and it names the document.*/
+    const char* name = (st->ir->name ? st->ir->name : "-");
+    h = hash_RCache (h, "ir", 2);
+    h = hash_RCache (h, name, strlen (name));
+  }
+  return h;
+}
+
+/** Write the cached HTML for {key} if there is a valid entry.**/
+static
+  bool
+emit_cached_HtmlState (HtmlState* st, uint64_t key)
+{
+  RCacheEntry entry[1];
+  struct iovec segs[1];
+  init_RCacheEntry (entry);
+  if (!open_RCacheEntry (entry, st->cache_dir, key))
+    return false;
+  segs[0].iov_base = (char*) entry->html;
+  segs[0].iov_len = entry->html_sz;
+  writev_OSink (st->sink, segs, 1);
+  for (i ; entry->ndeps) {
+    FileDep dep[1];
+    if (entry->deps[i].absent) {
+      add_absent_dep_HtmlState (st, 0, entry->deps[i].path);
+    }
+    else if (stat_FileDep (dep, 0, entry->deps[i].path, 0)) {
+      dep->hash = entry->deps[i].hash;
+      push_FileDep (&st->deps, dep);
+      lose_AlphaTab (&dep->path);
+    }
+  }
+  lose_RCacheEntry (entry);
+  return true;
+}
+
+/** Finish the render cache entry that the HTML was written to
+ * with the files that the document read, or drop it unless {keep}.
+ **/
+static
+  void
+close_cached_HtmlState (HtmlState* st, bool keep)
+{
+  RCacheDep* deps = AllocT( RCacheDep, st->deps.sz + 1 );
+  for (i ; st->deps.sz) {
+    deps[i].path = ccstr_of_AlphaTab (&st->deps.s[i].path);
+    deps[i].hash = st->deps.s[i].hash;
+    deps[i].absent = st->deps.s[i].absent;
+  }
+  close_RCacheWriter (st->cache_writer, deps, st->deps.sz, keep);
+  st->cache_writer = 0;
+  free (deps);
+}
+
+/** Add the time since {*t} to {*sec}, and restart {*t}.**/
+static
+  void
+lap_DocStats (double* sec, double* t)
+{
+  const double now = now_sec ();
+  *sec += now - *t;
+  *t = now;
+}
+
+/** Convert one whole document from {xf} into {st->sink}.
+ * With a render cache, a document whose text, files and options
+ * are unchanged is copied from the cache without being parsed.
+ **/
+static
+  bool
+htdocument (HtmlState* st, XFile* xf)
+{
+  DeclLegit( good );
+  TexIndex idx[1];
+  RCacheWriter cache_writer[1];
+  RCacheWriter* ir_writer = 0;
+  uint64_t key = 0;
+  DocStats* const ds = (StatsOn(st) ? st->stats : 0);
+  const zuint nallocs = thread_nallocs;
+  double t = (ds ? now_sec () : 0);
+  OSink* const sink = st->sink;
+  OSink html_sink[1];
+  xget_XFile (xf);
+  if (ds)
+    ds->input_sz = strlen (cstr_of_XFile (xf));
+  if (st->cache_dir) {
+    key = render_key_HtmlState (st, cstr_of_XFile (xf));
+    if (emit_cached_HtmlState (st, key)) {
+      if (ds) {
+        ds->cache_hit = true;
+        lap_DocStats (&ds->foot_sec, &t);
+        ds->nallocs = thread_nallocs - nallocs;
+      }
+      return st->sink->good;
+    }
+    if (open_RCacheWriter (cache_writer, st->cache_dir, key))
+      st->cache_writer = cache_writer;
+  }
+  if (st->ir) {
+    /* The IR is written instead of the HTML,
+     * so only the IR goes into the render cache.
+     */
+    begin_Ir (st->ir, cstr_of_XFile (xf));
+    init_count_OSink (html_sink);
+    st->sink = html_sink;
+    ir_writer = st->cache_writer;
+    st->cache_writer = 0;
+  }
+  init_TexIndex (idx);
+  HtLegitLine( st, "Failed to parse heading" )
+    hthead (st, xf);
+  if (ds)
+    lap_DocStats (&ds->head_sec, &t);
+  if (st->ir)
+    st->ir->cur = st->ir->root;
+  if (st->nthreads > 1) {
+    HtLegitLine( st, "Failed to parse body" )
+      htsections (st, xf);
+  }
+  else {
+    DoLegit( 0 ) {
+      build_TexIndex (idx, cstr_of_XFile (xf));
+      st->index = idx;
+    }
+    HtLegitLine( st, "Failed to parse body" )
+      htbody (st->body_ofile, xf, st);
+    st->index = 0;
+  }
+  lose_TexIndex (idx);
+  if (ds)
+    lap_DocStats (&ds->body_sec, &t);
+  DoLegit( 0 ) {
+    foot_html (st);
+  }
+  else {
+    /* Write the head anyway, as it was written before the body.*/
+    struct iovec segs[1];
+    emit_HtmlState (st, segs, 1);
+  }
+  if (ds) {
+    lap_DocStats (&ds->foot_sec, &t);
+    ds->nallocs = thread_nallocs - nallocs;
+  }
+  if (st->ir) {
+    st->ir->cur = 0;
+    st->sink = sink;
+    st->cache_writer = ir_writer;
+    emit_ir_HtmlState (st);
+  }
+  HtLegitLine( st, "Failed to write output" )
+    st->sink->good;
+  if (!st->end_document) {
+    good = false;
+  }
+  /* Documents with problems are converted again to report them.*/
+  if (st->cache_writer)
+    close_cached_HtmlState (st, good && st->allgood && st->nbogs == 0);
+  return good && st->allgood;
+}
+
+/** Conversion of a document whose text arrives in pieces.
+ *
+ * Text is kept until a place is found where it can be cut,
+ * then everything before that place is converted and written.
+ * A cut is made after a blank line that is outside of any braces,
+ * math, code, table or alignment environment, since those are parsed
+ * whole, and after \begin{document}, since the head is parsed whole.
+ * Lines are only scanned once they are complete.
+ * Parsing is not resumed inside a construct, so one large table
+ * or brace group is held in full until it closes.
+ **/
+typedef struct HtPush HtPush;
+struct HtPush
+{
+  HtmlState* st;
+  /** Text that is not converted yet.**/
+  OFile text[1];
+  /** Start of the first line of {text} that is not scanned yet.**/
+  zuint scan_off;
+  /** Braces open at the end of the scanned text.**/
+  uint depth;
+  /** Environments open at the end of the scanned text.**/
+  uint nenvs;
+  bool math;
+  bool code;
+  bool begun;
+  bool head_done;
+  bool good;
+};
+
+static
+  void
+init_HtPush (HtPush* p, HtmlState* st)
+{
+  p->st = st;
+  init_OFile (p->text);
+  p->scan_off = 0;
+  p->depth = 0;
+  p->nenvs = 0;
+  p->math = false;
+  p->code = false;
+  p->begun = false;
+  p->head_done = false;
+  p->good = true;
+}
+
+static
+  void
+lose_HtPush (HtPush* p)
+{
+  lose_OFile (p->text);
+}
+
+/** Scan the {n} bytes of a line, which is followed by its newline.
+ * Return whether the text can be cut after it.
+ *
+ * As in getenv_olay_TexIndex(), code and tables only end
+ * with an \end at the start of a line.
+ **/
+static
+  bool
+scan_line_HtPush (HtPush* p, const char* s, zuint n)
+{
+  if (p->code) {
+    if (0 == strncmp (s, "\\end{code}", 10))
+      p->code = false;
+    return false;
+  }
+  if (n == 0)
+    return (p->begun && p->depth == 0 && p->nenvs == 0 && !p->math);
+
+  for (zuint i = 0; i < n; ++i) {
+    const char c = s[i];
+    if (c == '%') {
+      break;
+    }
+    else if (c == '{') {
+      p->depth += 1;
+    }
+    else if (c == '}') {
+      if (p->depth > 0)
+        p->depth -= 1;
+    }
+    else if (c == '$') {
+      if (p->depth == 0)
+        p->math = !p->math;
+    }
+    else if (c == '\\') {
+      const char* t = &s[i+1];
+      if (0 == strncmp (t, "begin{code}", 11)) {
+        p->code = true;
+        return false;
+      }
+      if (0 == strncmp (t, "begin{document}", 15)) {
+        p->begun = true;
+      }
+      else if (0 == strncmp (t, "begin{", 6) &&
+               whole_env_line_ck (&t[6], i == 0))
+      {
+        p->nenvs += 1;
+      }
+      else if (0 == strncmp (t, "end{", 4) &&
+               whole_env_line_ck (&t[4], i == 0) &&
+               p->nenvs > 0)
+      {
+        p->nenvs -= 1;
+      }
+      /* Skip the escaped character, as in \{ or \%.*/
+      i += 1;
+    }
+  }
+  return false;
+}
+
+/** Convert the first {end} bytes of the kept text and write them out.**/
+static
+  bool
+convert_HtPush (HtPush* p, zuint end)
+{
+  DeclLegit( good );
+  HtmlState* st = p->st;
+  const zuint n = p->text->off;
+  AlphaTab ab = dflt_AlphaTab ();
+  XFile xf[1];
+  TexIndex idx[1];
+
+  /* Keep the rest, then parse the text in place.*/
+  oput_char_OFile (p->text, '\0');
+  init_AlphaTab_move_OFile (&ab, p->text);
+  init_OFile (p->text);
+  oputn_char_OFile (p->text, &ab.s[end], n - end);
+  p->scan_off -= end;
+  ab.s[end] = '\0';
+  ab.sz = end + 1;
+  init_XFile_olay_AlphaTab (xf, &ab);
+
+  if (!p->head_done) {
+    p->head_done = true;
+    HtLegitLine( st, "Failed to parse heading" )
+      hthead (st, xf);
+  }
+  init_TexIndex (idx);
+  DoLegit( 0 ) {
+    build_TexIndex (idx, cstr_of_XFile (xf));
+    st->index = idx;
+  }
+  HtLegitLine( st, "Failed to parse body" )
+    htbody (st->body_ofile, xf, st);
+  st->index = 0;
+  lose_TexIndex (idx);
+  lose_AlphaTab (&ab);
+
+  if (good && st->hold_flush == 0)
+    flush_body_HtmlState (st);
+  return good;
+}
+
+/** Take the next {n} bytes of the document,
+ * converting what can be converted so far.
+ **/
+static
+  bool
+push_HtPush (HtPush* p, const char* s, zuint n)
+{
+  zuint cut = 0;
+  const char* text;
+  const char* eol;
+  if (!p->good || p->st->end_document)
+    return p->good;
+
+  oputn_char_OFile (p->text, s, n);
+  text = window2_OFile (p->text, 0, p->text->off).s;
+  while ((eol = (const char*)
+          memchr (&text[p->scan_off], '\n', p->text->off - p->scan_off)))
+  {
+    const zuint off = (zuint) (eol - text);
+    if (scan_line_HtPush (p, &text[p->scan_off], off - p->scan_off))
+      cut = off + 1;
+    p->scan_off = off + 1;
+  }
+  if (cut > 0)
+    p->good = convert_HtPush (p, cut);
+  return p->good;
+}
+
+/** Convert the rest of the document and finish it.**/
+static
+  bool
+close_HtPush (HtPush* p)
+{
+  DeclLegit( good );
+  HtmlState* st = p->st;
+  good = p->good;
+  if (good && !st->end_document)
+    good = convert_HtPush (p, p->text->off);
+  DoLegit( 0 ) {
+    foot_html (st);
   }
   else {
-    DBog1( "I don't yet understand: \\%s", sym_cstr );
+    struct iovec segs[1];
+    emit_HtmlState (st, segs, 1);
   }
-
-  pos[0] = match;
-  offto_XFile (xf, pos);
-  if (match == '{') {
-    nextds_XFile (xf, 0, "}");
+  HtLegitLine( st, "Failed to write output" )
+    st->sink->good;
+  if (!st->end_document) {
+    good = false;
   }
+  p->good = good;
+  return good && st->allgood;
 }
 
+/** Write a path into a depfile, escaped the way make and ninja read it.**/
+static
   void
-escape_for_html (OFile* of, XFile* xf, Associa* macro_map)
+oput_depfile_path (OFile* of, const char* path)
 {
-  //const char delims[] = "\"'&<>";
-  const char delims[] = "\\\"&<>";
-  char* s;
-  char match = 0;
-  while ((s = nextds_XFile (xf, &match, delims)))
-  {
-    oput_cstr_OFile (of, s);
-    putlast_char_XFile (xf, match);
-
-    switch (match)
-    {
-    case '"':
-      oput_cstr_OFile (of, "&quot;");
-      break;
-    case '\'':
-      oput_cstr_OFile (of, "&#39;");
-      break;
-    case '&':
-      oput_cstr_OFile (of, "&amp;");
-      break;
-    case '<':
-      oput_cstr_OFile (of, "&lt;");
-      break;
-    case '>':
-      oput_cstr_OFile (of, "&gt;");
-      break;
-    case '\\':
-      if (macro_map)
-        handle_macro (of, xf, macro_map);
-      else
-        oput_char_OFile (of, '\\');
-      break;
-    default:
-      break;
-    }
+  for (; *path; ++path) {
+    const char c = *path;
+    if (c == '$')
+      oput_char_OFile (of, '$');
+    else if (c == ' ' || c == '\t' || c == '#')
+      oput_char_OFile (of, '\\');
+    oput_char_OFile (of, c);
   }
 }
 
+/** Make a depfile rule saying that {target} depends on the {nsrcs} files
+ * in {srcs} and on every file that the document read.
+ * Files that the document found along the search paths appear as
+ * the paths they were found at.
+ * Each file also gets an empty rule of its own,
+ * so deleting one does not break the build.
+ **/
 static
   void
-add_newcommand (Associa* macro_map, const char* key_cstr, const char* val_cstr)
+oput_depfile (OFile* of, const HtmlState* st, const char* target,
+              const char* const* srcs, uint nsrcs)
 {
-  AlphaTab key[1];
-  AlphaTab val[1];
-  Assoc* item;
-  bool added = false;
-
-  *key = cons1_AlphaTab (key_cstr);
-  *val = cons1_AlphaTab (val_cstr);
-
-  item = ensure1_Associa (macro_map, key, &added);
-
-  {
-    XFile xtmp[1];
-    OFile otmp[] = default;
-    init_XFile_move_AlphaTab (xtmp, val);
-    escape_for_html (otmp, xtmp, macro_map);
-    init_AlphaTab_move_OFile (val, otmp);
+  const char** paths = AllocT( const char*, nsrcs + st->deps.sz + 1 );
+  uint npaths = 0;
+  for (i ; nsrcs)
+    paths[npaths++] = srcs[i];
+  for (i ; st->deps.sz) {
+    const char* path = ccstr_of_AlphaTab (&st->deps.s[i].path);
+    bool dup = st->deps.s[i].absent;
+    for (j ; npaths)
+      dup = dup || eq_cstr (path, paths[j]);
+    if (!dup)
+      paths[npaths++] = path;
   }
 
-  if (added) {
-    val_fo_Assoc (macro_map, item, val);
+  oput_depfile_path (of, target);
+  oput_char_OFile (of, ':');
+  for (i ; npaths) {
+    oput_cstr_OFile (of, " \\\n ");
+    oput_depfile_path (of, paths[i]);
   }
-  else {
-    lose_AlphaTab (key);
-    copy_AlphaTab ((AlphaTab*) val_of_Assoc (macro_map, item), val);
-    lose_AlphaTab (val);
+  oput_char_OFile (of, '\n');
+  for (i ; npaths) {
+    oput_char_OFile (of, '\n');
+    oput_depfile_path (of, paths[i]);
+    oput_cstr_OFile (of, ":\n");
   }
+  free (paths);
 }
 
-static
-  bool
-parse_newcommand (XFile* xfile, Associa* macro_map)
+/** One document of a batch.**/
+typedef struct BatchJob BatchJob;
+struct BatchJob
 {
-  DeclLegit( good );
-  Trit mayflush = mayflush_XFile (xfile, Nil);
-  char* key_cstr = 0;
-  char* val_cstr = 0;
-
-  DoLegitLineP( key_cstr, "need argument for \\newcommand" )
-    getlined_XFile (xfile, "}{");
-
-  DoLegitLineP( val_cstr, "need second argument for \\newcommand" )
-    getmatchd_XFile (xfile, "{", "}");
+  uint lineno;
+  const char* input;
+  const char* output;
+  /** Per-document options as flag/argument pairs.**/
+  TableT(AlphaTab) opts;
+  zuint input_sz;
+  bool done;
+  bool good;
+  /** Output when it goes to stdout.**/
+  OFile out[1];
+  /** Messages for stderr.**/
+  OFile err[1];
+  /** The input and every file it read when last converted.**/
+  TableT(AlphaTab) deps;
+};
+DeclTableT( BatchJob, BatchJob );
 
-  DoLegit( 0 ) {
-    add_newcommand (macro_map, key_cstr, val_cstr);
-  }
-  mayflush_XFile (xfile, mayflush);
-  return !!good;
-}
+/** Documents from a manifest and the state shared by all workers.**/
+typedef struct Batch Batch;
+struct Batch
+{
+  HtmlState* proto;
+  /** The manifest, whose text the jobs point into.**/
+  XFileB manifest_xfb[1];
+  const char* dir;
+  TableT(BatchJob) jobs;
+  /** Jobs in the order they are taken, largest input first.**/
+  BatchJob** order;
+  uint next_order;
+  /** Index of the next job whose stdout/stderr text gets written.**/
+  uint next_emit;
+  bool good;
+  /** Output counts of all jobs.**/
+  OSink* stats;
+  /** Comma-separated -stats objects of finished jobs, or null.**/
+  OFile* json;
+  pthread_mutex_t lock;
+};
 
+/** Parse a manifest line into {job}.
+ * The line has the form: INPUT OUTPUT [-def NAME VALUE]... [-css PATH]
+ **/
 static
   bool
-hthead (HtmlState* st, XFile* xf)
+parse_BatchJob (BatchJob* job, XFile* line)
 {
   DeclLegit( good );
-  while (good)
+  uint nargs = 0;
+  char* tok;
+
+  while (good &&
+         (skipds_XFile (line, WhiteSpaceChars),
+          (tok = nextds_XFile (line, 0, WhiteSpaceChars))) &&
+         tok[0] != '\0')
   {
-    XFile olay[1];
-    DoLegitLine( "" )
-      !!getlined_XFile (xf, "\\");
-    if (!good) {
-      return false;
+    uint nvals = 0;
+    if (nargs == 0) {
+      job->input = tok;
     }
-    else if (skip_cstr_XFile (xf, "begin{document}")) {
-      skipds_XFile (xf, WhiteSpaceChars);
-      break;
+    else if (nargs == 1) {
+      job->output = tok;
     }
-    else if (skip_cstr_XFile (xf, "title[") ||
-             skip_cstr_XFile (xf, "title{"))
-    {
-      const bool optional = ('[' == *ccstr1_of_XFile (xf, xf->off-1));
-
-      DoLegitLine( "Second \\title?" )
-        null_ck_AlphaTab (&st->title);
-
-      if (optional) {
-        DoLegitLine( "title has no closing bracket / opening brace" )
-          getlined_olay_XFile (olay, xf, "]{");
-
-        if (good) {
-          OFile tmp_ofile = default;
-          escape_for_html (&tmp_ofile, olay, &st->macro_map);
-          init_AlphaTab_move_OFile (&st->pagetitle, &tmp_ofile);
-        }
-      }
-
-      DoLegitLine( "title has no closing brace" )
-        getlined_olay_XFile (olay, xf, "}");
-
-      if (good) {
-        OFile tmp_ofile = default;
-        escape_for_html (&tmp_ofile, olay, &st->macro_map);
-        init_AlphaTab_move_OFile (&st->title, &tmp_ofile);
-        if (!optional) {
-          copy_AlphaTab (&st->pagetitle, &st->title);
-        }
-      }
+    else if (eq_cstr ("-def", tok)) {
+      nvals = 2;
     }
-    else if (skip_cstr_XFile (xf, "author{"))
-    {
-      DoLegitLine( "no closing brace" )
-        getlined_olay_XFile (olay, xf, "}");
-
-      DoLegitLine( "Second \\author?" )
-        null_ck_AlphaTab (&st->author);
-
-      if (good) {
-        OFile tmp_ofile = default;
-        escape_for_html (&tmp_ofile, olay, &st->macro_map);
-        init_AlphaTab_move_OFile (&st->author, &tmp_ofile);
-      }
+    else if (eq_cstr ("-css", tok)) {
+      nvals = 1;
     }
-    else if (skip_cstr_XFile (xf, "date{"))
-    {
-      DoLegitLine( "no closing brace" )
-        getlined_olay_XFile (olay, xf, "}");
-      DoLegitLine( "Second \\date?" )
-        null_ck_AlphaTab (&st->date);
-      if (good) {
-        OFile tmp_ofile = default;
-        escape_for_html (&tmp_ofile, olay, &st->macro_map);
-        init_AlphaTab_move_OFile (&st->date, &tmp_ofile);
-      }
+    else {
+      DBog1( "unknown manifest option: %s", tok );
+      good = false;
     }
-    else if (skip_cstr_XFile (xf, "newcommand{\\")) {
-      good = parse_newcommand (xf, &st->macro_map);
+    ++ nargs;
+    if (nvals > 0) {
+      *Grow1Table( job->opts ) = dflt1_AlphaTab (tok);
+    }
+    while (good && nvals > 0) {
+      skipds_XFile (line, WhiteSpaceChars);
+      tok = nextds_XFile (line, 0, WhiteSpaceChars);
+      DoLegitLine( "missing argument in manifest" )
+        (tok && tok[0] != '\0');
+      if (good)
+        *Grow1Table( job->opts ) = dflt1_AlphaTab (tok);
+      -- nvals;
     }
   }
-  if (good) {
-    head_html (st);
-  }
-  st->allgood = st->allgood && good;
+  DoLegitLine( "need an input and an output" )
+    (nargs >= 2);
   return good;
 }
 
+/** Convert the document of {job} using the worker's state {st}.**/
 static
   void
-open_paragraph (HtmlState* st)
+run_BatchJob (Batch* batch, HtmlState* st, BatchJob* job)
 {
-  OFile* ofile = st->body_ofile;
-  if (st->inparagraph)  return;
-  oput_cstr_OFile (ofile, "\n<p");
-  if (st->cram) {
-    oput_cstr_OFile (ofile, " class=\"cram\"");
+  DeclLegit( good );
+  InFile in[1];
+  OSink sink[1];
+  int fd = -1;
+
+  init_InFile (in);
+  init_mem_OSink (sink, job->out);
+  reset_HtmlState (st, batch->proto, sink);
+  st->errfile = job->err;
+  for (uint i = 0; i < job->opts.sz; ) {
+    const char* flag = ccstr_of_AlphaTab (&job->opts.s[i]);
+    if (eq_cstr ("-def", flag)) {
+      add_newcommand (st, ccstr_of_AlphaTab (&job->opts.s[i+1]), 0,
+                      ccstr_of_AlphaTab (&job->opts.s[i+2]));
+      i += 3;
+    }
+    else {
+      copy_AlphaTab (&st->css_filepath, &job->opts.s[i+1]);
+      i += 2;
+    }
   }
-  oput_cstr_OFile (ofile, ">");
-  st->inparagraph = true;
-  st->eol = false;
-  st->cram = true;
+
+  HtLegitLine( st, "open file for reading" )
+    open_InFile (in, batch->dir, job->input);
+  if (good && !eq_cstr ("-", job->output)) {
+    fd = open_output_fd (batch->dir, job->output);
+    HtLegitLine( st, "open file for writing" )
+      (fd >= 0);
+    if (good)
+      init_fd_OSink (sink, fd);
+  }
+
+  if (good) {
+    st->pathname = ccstr_of_AlphaTab (&in->pathname);
+    if (st->ir)
+      st->ir->name = job->input;
+    good = htdocument (st, in->xf);
+    if (!good)
+      htbog (st, "Failed to convert: ", job->input);
+  }
+  else {
+    htbog (st, "Cannot convert: ", job->input);
+  }
+  job->good = good;
+  lose_InFile (in);
+  if (fd >= 0)
+    close (fd);
+
+  for (i ; job->deps.sz)
+    lose_AlphaTab (&job->deps.s[i]);
+  job->deps.sz = 0;
+  {
+    AlphaTab* path = Grow1Table( job->deps );
+    *path = dflt_AlphaTab ();
+    cat_filepath_AlphaTab (path, batch->dir, job->input);
+  }
+  for (i ; st->deps.sz) {
+    const AlphaTab* path = &st->deps.s[i].path;
+    if (!st->deps.s[i].absent)
+      *Grow1Table( job->deps ) = cons1_AlphaTab (ccstr_of_AlphaTab (path));
+  }
+
+  pthread_mutex_lock (&batch->lock);
+  add_stats_OSink (batch->stats, sink);
+  if (batch->json && st->stats) {
+    if (batch->json->off > 0)
+      oput_char_OFile (batch->json, ',');
+    oput_json_DocStats (batch->json, st->stats, job->input);
+  }
+  pthread_mutex_unlock (&batch->lock);
 }
 
+/** Write out the stdout and stderr text of {job}.**/
 static
   void
-close_paragraph (HtmlState* st)
+emit_BatchJob (BatchJob* job)
 {
-  OFile* ofile = st->body_ofile;
-  if (!st->inparagraph)  return;
-  oput_cstr_OFile (ofile, "</p>");
-  st->inparagraph = false;
-  st->cram = false;
-  st->eol = false;
+  oput_OFile (stdout_OFile (), job->out);
+  oput_OFile (stderr_OFile (), job->err);
+  flush_OFile (stdout_OFile ());
+  flush_OFile (stderr_OFile ());
+  lose_OFile (job->out);
+  lose_OFile (job->err);
+  init_OFile (job->out);
+  init_OFile (job->err);
 }
 
+/** Write out stdout and stderr text of finished jobs in manifest order.
+ * The caller must hold {batch->lock}.
+ **/
 static
   void
-open_list (HtmlState* st, const char* tag)
+emit_BatchJobs (Batch* batch)
 {
-  OFile* ofile = st->body_ofile;
-  bool cram = st->inparagraph && st->list_depth == 0;
-  if (cram) {
-    close_paragraph (st);
+  while (batch->next_emit < batch->jobs.sz &&
+         batch->jobs.s[batch->next_emit].done)
+  {
+    emit_BatchJob (&batch->jobs.s[batch->next_emit++]);
   }
-  st->inparagraph = true;
+}
 
-  st->list_depth += 1;
-  oput_cstr_OFile (ofile, "<");
-  oput_cstr_OFile (ofile, tag);
-  if (cram) {
-    oput_cstr_OFile (ofile, " class=\"cram\"");
+/** A thread of a batch conversion, with its own HtmlState.**/
+typedef struct BatchWorker BatchWorker;
+struct BatchWorker
+{
+  Batch* batch;
+  HtmlState st[1];
+  DocStats stats[1];
+  Ir ir[1];
+  pthread_t thread;
+};
+
+/** Take jobs from the shared queue until none are left.**/
+static
+  void*
+batch_worker (void* arg)
+{
+  BatchWorker* worker = (BatchWorker*) arg;
+  Batch* batch = worker->batch;
+
+  for (;;) {
+    BatchJob* job = 0;
+    pthread_mutex_lock (&batch->lock);
+    if (batch->next_order < batch->jobs.sz)
+      job = batch->order[batch->next_order++];
+    pthread_mutex_unlock (&batch->lock);
+    if (!job)  break;
+
+    run_BatchJob (batch, worker->st, job);
+
+    pthread_mutex_lock (&batch->lock);
+    job->done = true;
+    if (!job->good)
+      batch->good = false;
+    emit_BatchJobs (batch);
+    pthread_mutex_unlock (&batch->lock);
   }
-  oput_cstr_OFile (ofile, ">");
-  st->list_item_open = false;
+  return 0;
+}
+
+static
+  int
+cmp_BatchJob_size (const void* a, const void* b)
+{
+  const BatchJob* x = *(BatchJob* const*) a;
+  const BatchJob* y = *(BatchJob* const*) b;
+  if (x->input_sz != y->input_sz)
+    return (x->input_sz > y->input_sz) ? -1 : 1;
+  return (x->lineno < y->lineno) ? -1 : (x->lineno > y->lineno);
 }
 
 static
   void
-close_list (HtmlState* st, const char* tag)
+init_Batch (Batch* batch, HtmlState* proto, OSink* stats, OFile* json)
 {
-  OFile* ofile = st->body_ofile;
-  if (st->list_item_open) {
-    oput_cstr_OFile (ofile, "</li>\n");
-  }
-  oput_cstr_OFile (ofile, "</");
-  oput_cstr_OFile (ofile, tag);
-  oput_cstr_OFile (ofile, ">");
-  st->list_depth -= 1;
-  if (st->list_depth > 0) {
-    oput_cstr_OFile (ofile, "</li>\n");
-  }
-  else {
-    st->inparagraph = false;
+  XFileB xfb = default;
+  batch->proto = proto;
+  *batch->manifest_xfb = xfb;
+  batch->dir = 0;
+  InitTable( batch->jobs );
+  batch->order = 0;
+  batch->next_order = 0;
+  batch->next_emit = 0;
+  batch->good = true;
+  batch->stats = stats;
+  batch->json = json;
+  pthread_mutex_init (&batch->lock, 0);
+}
+
+static
+  void
+lose_Batch (Batch* batch)
+{
+  for (i ; batch->jobs.sz) {
+    BatchJob* job = &batch->jobs.s[i];
+    LoseTable( job->opts );
+    lose_OFile (job->out);
+    lose_OFile (job->err);
+    for (j ; job->deps.sz)
+      lose_AlphaTab (&job->deps.s[j]);
+    LoseTable( job->deps );
   }
-  st->list_item_open = false;
+  LoseTable( batch->jobs );
+  if (batch->order)
+    free (batch->order);
+  pthread_mutex_destroy (&batch->lock);
+  lose_XFileB (batch->manifest_xfb);
 }
 
+/** Read the jobs listed in {manifest}.
+ *
+ * Each line of the manifest reads:
+ *   INPUT OUTPUT [-def NAME VALUE]... [-css PATH]
+ * where relative paths are taken from the manifest's directory
+ * and an OUTPUT of "-" means stdout.
+ * Blank lines and lines starting with '#' are skipped.
+ **/
 static
   bool
-insert_href (HtmlState* st, XFile* xf, bool black)
+load_Batch (Batch* batch, const char* manifest)
 {
   DeclLegit( good );
-  OFile* of = st->body_ofile;
-  XFile olay[1];
-  open_paragraph (st);
-  DoLegitLine( "no closing/open for href" )
-    getlined_olay_XFile (olay, xf, "}{");
+  XFile* manifest_xf = &batch->manifest_xfb->xf;
+  uint lineno = 0;
+  XFile line[1];
 
-  DoLegit( "no closing brace for href" )
-  {
-    oput_cstr_OFile (of, "<a ");
-    if (black)
-      oput_cstr_OFile (of, "class=\"texturl\" ");
-    oput_cstr_OFile (of, "href=\"");
-    escape_for_html (of, olay, &st->macro_map);
-    oput_cstr_OFile (of, "\">");
-    good = getlined_olay_XFile (olay, xf, "}");
-  }
+  DoLegitLine( "open manifest for reading" )
+    open_FileB (&batch->manifest_xfb->fb, 0, manifest);
   if (good) {
-    htbody (of, olay, st);
-    oput_cstr_OFile (of, "</a>");
+    batch->dir = ccstr_of_AlphaTab (&batch->manifest_xfb->fb.pathname);
+    xget_XFile (manifest_xf);
+  }
+
+  while (good && getlined_olay_XFile (line, manifest_xf, "\n"))
+  {
+    BatchJob* job;
+    ++ lineno;
+    skipds_XFile (line, WhiteSpaceChars);
+    if (eq_cstr ("", ccstr_of_XFile (line)) ||
+        '#' == ccstr_of_XFile (line)[0])
+      continue;
+
+    job = Grow1Table( batch->jobs );
+    job->lineno = lineno;
+    job->input = 0;
+    job->output = 0;
+    InitTable( job->opts );
+    job->input_sz = 0;
+    job->done = false;
+    job->good = false;
+    init_OFile (job->out);
+    init_OFile (job->err);
+    InitTable( job->deps );
+    if (!parse_BatchJob (job, line)) {
+      DBog2( "%s:%u: bad manifest line", manifest, lineno );
+      good = false;
+    }
   }
   return good;
 }
 
+/** Give {worker} a state like {batch->proto}.**/
+static
+  void
+init_BatchWorker (BatchWorker* worker, Batch* batch)
+{
+  const HtmlState* proto = batch->proto;
+  worker->batch = batch;
+  init_worker_HtmlState (worker->st, proto);
+  if (batch->json) {
+    init_DocStats (worker->stats, ArraySz(htcmds));
+    worker->st->stats = worker->stats;
+  }
+  if (proto->ir) {
+    init_Ir (worker->ir);
+    worker->st->ir = worker->ir;
+  }
+}
+
+static
+  void
+lose_BatchWorker (BatchWorker* worker)
+{
+  if (worker->st->stats)
+    lose_DocStats (worker->stats);
+  if (worker->st->ir)
+    lose_Ir (worker->ir);
+  lose_HtmlState (worker->st);
+}
+
+/** Convert every document listed in a manifest file,
+ * which load_Batch() describes.
+ *
+ * Documents are spread over {nworkers} threads, each of which resets
+ * and reuses one HtmlState.
+ * Workers take the largest remaining input first so that a big
+ * document does not start last.
+ * Text for stdout and stderr is written in manifest order,
+ * so the output matches that of a serial run.
+ * With {json}, the -stats of each document are added to it
+ * in the order that they finish.
+ **/
 static
   bool
-next_section (OFile* of, XFile* xf, HtmlState* st)
+batch_htdocuments (HtmlState* proto, const char* manifest, uint nworkers,
+                   OSink* stats, OFile* json)
 {
   DeclLegit( good );
-  XFile olay[1];
-  OFile* toc = st->toc_ofile;
-  const Trit mayflush = mayflush_XFile (xf, Nil);
-  AlphaTab label = default;
-  bool subsec = (st->nsubsections > 0);
-  const char* heading = (subsec ? "h3" : "h2");
+  Batch batch[1];
+  BatchWorker* workers;
+  uint nstarted = 1;
 
-  DoLegitLine( "no closing brace for \\section" )
-    getmatchd_olay_XFile (olay, xf, "{", "}");
+  init_Batch (batch, proto, stats, json);
+  good = load_Batch (batch, manifest);
 
-  if (!good) {
-    mayflush_XFile (xf, mayflush);
-    return false;
-  }
-
-  skipds_XFile (xf, WhiteSpaceChars);
-  if (skip_cstr_XFile (xf, "\\label{")) {
-    char* txt = getlined_XFile (xf, "}");
-    if (txt)
-      label = dflt1_AlphaTab (txt);
-  }
-  if (empty_ck_AlphaTab (&label)) {
-    cat_cstr_AlphaTab (&label, "sec:");
-    cat_uint_AlphaTab (&label, st->nsections);
-    if (subsec) {
-      cat_char_AlphaTab (&label, '.');
-      cat_uint_AlphaTab (&label, st->nsubsections);
+  if (good && batch->jobs.sz > 0) {
+    batch->order = AllocT( BatchJob*, batch->jobs.sz );
+    for (i ; batch->jobs.sz) {
+      BatchJob* job = &batch->jobs.s[i];
+      AlphaTab path[] = default;
+      struct stat sb;
+      cat_filepath_AlphaTab (path, batch->dir, job->input);
+      if (0 == stat (ccstr_of_AlphaTab (path), &sb))
+        job->input_sz = sb.st_size;
+      lose_AlphaTab (path);
+      batch->order[i] = job;
     }
-  }
+    qsort (batch->order, batch->jobs.sz, sizeof(BatchJob*), cmp_BatchJob_size);
 
-  st->inparagraph = true;
+    if (nworkers > batch->jobs.sz)
+      nworkers = batch->jobs.sz;
+    workers = AllocT( BatchWorker, nworkers );
+    for (i ; nworkers)
+      init_BatchWorker (&workers[i], batch);
 
-  printf_OFile (of, "\n<%s id=\"", heading);
-  oput_AlphaTab (of, &label);
-  printf_OFile (of, "\">%u.", st->nsections);
-  if (subsec)
-    printf_OFile (of, "%u.", st->nsubsections);
-  oput_char_OFile (of, ' ');
-  {
-    AlphaTab tmp = cons1_AlphaTab (ccstr_of_XFile (olay));
-    XFile olay2[1];
-    init_XFile_move_AlphaTab (olay2, &tmp);
-    htbody (of, olay2, st);
+    /* The calling thread is the first worker, so a thread that cannot
+     * be started only leaves more jobs for the others.
+     */
+    while (nstarted < nworkers &&
+           0 == pthread_create (&workers[nstarted].thread, 0,
+                                batch_worker, &workers[nstarted]))
+      ++ nstarted;
+    batch_worker (&workers[0]);
+    for (uint i = 1; i < nstarted; ++i)
+      pthread_join (workers[i].thread, 0);
+
+    for (i ; nworkers)
+      lose_BatchWorker (&workers[i]);
+    free (workers);
+    good = batch->good;
   }
-  printf_OFile (of, "</%s>", heading);
 
+  lose_Batch (batch);
+  return good;
+}
+
+/** Milliseconds to wait for more changes before converting again,
+ * since saving one file can take a few events.
+ **/
+#define WatchSettleMs 5
 
-  if (st->nsections == 1 && st->nsubsections == 0)
-    oput_cstr_OFile (toc, "\n<ol class=\"cram\">");
-  else if (st->nsubsections == 1)
-    oput_cstr_OFile (toc, "\n<ol>");
-  else
-    oput_cstr_OFile (toc, "</li>");
+/** A directory that -watch looks at.**/
+typedef struct WatchDir WatchDir;
+struct WatchDir
+{
+  int wd;
+  /** Directory part of the paths in it, with a trailing slash,
+   * or empty for the current directory.
+   **/
+  AlphaTab dir;
+  zuint dir_sz;
+};
+DeclTableT( WatchDir, WatchDir );
 
-  oput_cstr_OFile (toc, "\n<li><a href=\"#");
-  oput_AlphaTab (toc, &label);
-  oput_cstr_OFile (toc, "\">");
-  htbody (toc, olay, st);
-  oput_cstr_OFile (toc, "</a>");
-  lose_AlphaTab (&label);
+/** Watch the directory of {path} unless it already is.**/
+static
+  void
+watch_path (int fd, TableT(WatchDir)* dirs, const char* path)
+{
+  const char* slash = strrchr (path, '/');
+  const zuint n = (slash ? (zuint) (slash - path) + 1 : 0);
+  WatchDir* dir;
+  int wd;
 
-  st->inparagraph = false;
+  for (i ; dirs->sz) {
+    const WatchDir* x = &dirs->s[i];
+    if (x->dir_sz == n &&
+        0 == memcmp (ccstr_of_AlphaTab (&x->dir), path, n))
+      return;
+  }
+  dir = Grow1Table( *dirs );
+  init_AlphaTab_chars (&dir->dir, path, n);
+  dir->dir_sz = n;
+  wd = inotify_add_watch (fd, (n == 0 ? "." : ccstr_of_AlphaTab (&dir->dir)),
+                          IN_CLOSE_WRITE | IN_MOVED_TO |
+                          IN_DELETE | IN_ATTRIB);
+  dir->wd = wd;
+  if (wd < 0)
+    DBog1( "cannot watch the directory of: %s", path );
+}
+
+/** Mark the jobs that read {path} as needing another conversion.**/
+static
+  bool
+mark_BatchJobs (Batch* batch, bool* dirty, const char* path)
+{
+  bool any = false;
+  for (i ; batch->jobs.sz) {
+    const BatchJob* job = &batch->jobs.s[i];
+    for (j ; job->deps.sz) {
+      if (!dirty[i] && eq_cstr (path, ccstr_of_AlphaTab (&job->deps.s[j]))) {
+        dirty[i] = true;
+        any = true;
+      }
+    }
+  }
+  return any;
+}
+
+/** Wait until files that jobs read have changed and mark those jobs.
+ * Once one job is marked, changes are gathered until none come
+ * for WatchSettleMs.
+ **/
+static
+  bool
+wait_watch (int fd, const TableT(WatchDir)* dirs,
+            Batch* batch, bool* dirty)
+{
+  char buf[sizeof (struct inotify_event) + NAME_MAX + 1]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  AlphaTab path = dflt_AlphaTab ();
+  bool any = false;
+
+  for (;;) {
+    struct pollfd pfd[1];
+    ssize_t n;
+    int ret;
+    pfd->fd = fd;
+    pfd->events = POLLIN;
+    pfd->revents = 0;
+    ret = poll (pfd, 1, (any ? WatchSettleMs : -1));
+    if (ret == 0)
+      break;
+    n = (ret > 0 ? read (fd, buf, sizeof (buf)) : -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      lose_AlphaTab (&path);
+      return false;
+    }
 
-  mayflush_XFile (xf, mayflush);
+    for (char* p = buf; p < buf + n; ) {
+      const struct inotify_event* ev = (const struct inotify_event*) p;
+      p += sizeof (*ev) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        /* Events were lost, so convert everything.*/
+        for (i ; batch->jobs.sz)
+          dirty[i] = true;
+        any = true;
+        continue;
+      }
+      if (ev->len == 0)
+        continue;
+      for (i ; dirs->sz) {
+        const WatchDir* dir = &dirs->s[i];
+        if (dir->wd != ev->wd)
+          continue;
+        lose_AlphaTab (&path);
+        path = dflt_AlphaTab ();
+        cat_cstr_AlphaTab (&path, ccstr_of_AlphaTab (&dir->dir));
+        cat_cstr_AlphaTab (&path, ev->name);
+        if (mark_BatchJobs (batch, dirty, ccstr_of_AlphaTab (&path)))
+          any = true;
+      }
+    }
+  }
+  lose_AlphaTab (&path);
   return true;
 }
 
-
-// \\  -->  <br />
-// \   -->  &nbsp;
-// \quicksec{TEXT}  -->  <b>TEXT.</b>
-// \expten{NUM}  -->  &times;10<sup>NUM</sup>
-// \textit{TEXT}  -->  <it>TEXT</it>
-// \textbf{TEXT}  -->  <b>TEXT</b>
-// \texttt{TEXT}  -->  <b>TEXT</b>
-// \underline{TEXT}  -->  <u>TEXT</u>
-// \ilcode{...}  -->  <code>...</code>
-// \ilflag{...}
-// \ilfile{...}
-// \ilsym{...}
-// \illit{...}
-// \ilname{...}
-// \ilkey{...}
-// \ttvbl{...}
-// $...$  -->  <i>...</i>
-// \begin{code}\n...\n\end{code}  -->  <pre><code>...</code></pre>
-// \begin{center}  -->  <div class="cjust">...</div>
-// \begin{tabular}  -->  <table>...</table>
-// \href{URL}{TEXT}  -->  <a href="URL">TEXT</a>
-// \url{URL}  -->  <a href="URL">URL</a>
-// \caturl{URL}  -->  <a href="URL">URL</a>
-// \includegraphics{URL}  -->  <img src="URL" />
-// \section{TEXT}  -->  <h2>TEXT</h2>
-// \subsection{TEXT}  -->  <h3>TEXT</h3>
-// \label{myname}  -->  <a name="myname">...</a>
+/** Keep the documents listed in a manifest file converted.
+ *
+ * All documents are converted once, and then again whenever a file
+ * that they read changes.
+ * The directories of those files are watched with inotify,
+ * which also catches editors that save by renaming a new file.
+ * One HtmlState is reused throughout, so the macros of {proto}
+ * and the \input files that did not change are not parsed again.
+ * This only stops on an error or a signal.
+ **/
+static
   bool
-htbody (OFile* of, XFile* xf, HtmlState* st)
+watch_htdocuments (HtmlState* proto, const char* manifest, OSink* stats)
 {
   DeclLegit( good );
+  Batch batch[1];
+  BatchWorker worker[1];
+  TableT(WatchDir) dirs;
+  bool* dirty = 0;
+  int fd = -1;
 
-  while (good && !st->end_document)
-  {
-    XFile olay[1];
-    char match = 0;
-    bool pending_newline;
-    if (!nextds_olay_XFile (olay, xf, &match, "\n\\%$-"))
-      break;
+  InitTable( dirs );
+  init_Batch (batch, proto, stats, 0);
+  init_BatchWorker (worker, batch);
+  good = load_Batch (batch, manifest);
+  DoLegit( "cannot start inotify" ) {
+    fd = inotify_init1 (IN_CLOEXEC);
+    good = (fd >= 0);
+  }
+  if (good) {
+    dirty = AllocT( bool, batch->jobs.sz + 1 );
+    for (i ; batch->jobs.sz)
+      dirty[i] = true;
+  }
 
-    //skipds_XFile (olay, WhiteSpaceChars);
-    if (eq_cstr ("", ccstr_of_XFile (olay)))
-    {
-      if (match == '\n' && st->eol) {
-        close_paragraph (st);
-        st->cram = false;
-      }
+  while (good) {
+    struct timespec beg, end;
+    uint n = 0;
+    clock_gettime (CLOCK_MONOTONIC, &beg);
+    for (i ; batch->jobs.sz) {
+      BatchJob* job = &batch->jobs.s[i];
+      if (!dirty[i])
+        continue;
+      dirty[i] = false;
+      run_BatchJob (batch, worker->st, job);
+      emit_BatchJob (job);
+      for (j ; job->deps.sz)
+        watch_path (fd, &dirs, ccstr_of_AlphaTab (&job->deps.s[j]));
+      n += 1;
     }
-    else
+    clock_gettime (CLOCK_MONOTONIC, &end);
     {
-      open_paragraph (st);
-      if (st->eol) {
-        oput_cstr_OFile (of, "\n");
-        st->eol = false;
-      }
-      escape_for_html (of, olay, &st->macro_map);
+      const unsigned long us =
+        (unsigned long) ((end.tv_sec - beg.tv_sec) * 1000000 +
+                         (end.tv_nsec - beg.tv_nsec) / 1000);
+      printf_OFile (stderr_OFile (),
+                    "watch: converted %u documents in %lu.%lu ms\n",
+                    n, us / 1000, us / 100 % 10);
+      flush_OFile (stderr_OFile ());
     }
+    DoLegitLine( "cannot read inotify events" )
+      wait_watch (fd, &dirs, batch, dirty);
+  }
 
-    pending_newline = (st->eol && st->inparagraph);
-    st->eol = false;
+  if (fd >= 0)
+    close (fd);
+  for (i ; dirs.sz)
+    lose_AlphaTab (&dirs.s[i].dir);
+  LoseTable( dirs );
+  if (dirty)
+    free (dirty);
+  lose_BatchWorker (worker);
+  lose_Batch (batch);
+  return good;
+}
 
-    if (!good) {
-    }
-    else if (match == '\n') {
-      st->eol = true;
-    }
-    else if (match == '%') {
-      st->eol = true;
-      getline_XFile (xf);
-    }
-    else if (match == '$') {
-      open_paragraph (st);
-      oput_cstr_OFile (of, "<i>");
-      DoLegitLine( "no closing dollar sign" )
-        getlined_olay_XFile (olay, xf, "$");
-      if (good) {
-        escape_for_html (of, olay, &st->macro_map);
-        oput_cstr_OFile (of, "</i>");
-      }
-    }
-    else if (match == '-') {
-      if (pending_newline)
-        oput_char_OFile (of, '\n');
-      if (skip_cstr_XFile (xf, "-"))
-        oput_cstr_OFile (of, "&ndash;");
-      else
-        oput_char_OFile (of, '-');
-    }
-    else if (match == '\\') {
-      if (skip_cstr_XFile (xf, "\\")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<br />");
-      }
-      else if (skip_cstr_XFile (xf, " ")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "&nbsp;");
-      }
-      else if (skip_cstr_XFile (xf, "%")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "%");
-      }
-      else if (skip_cstr_XFile (xf, "begin{itemize}") ||
-               skip_cstr_XFile (xf, "begin{itemize*}"))
-      {
-        open_list (st, "ul");
-      }
-      else if (skip_cstr_XFile (xf, "begin{enumerate}") ||
-               skip_cstr_XFile (xf, "begin{enumerate*}"))
-      {
-        open_list (st, "ol");
-      }
-      else if (skip_cstr_XFile (xf, "end{itemize}") ||
-               skip_cstr_XFile (xf, "end{itemize*}"))
-      {
-        close_list (st, "ul");
-      }
-      else if (skip_cstr_XFile (xf, "end{enumerate}") ||
-               skip_cstr_XFile (xf, "end{enumerate*}"))
-      {
-        close_list (st, "ol");
-      }
-      else if (skip_cstr_XFile (xf, "item")) {
-        if (st->list_item_open) {
-          oput_cstr_OFile (of, "</li>\n");
-        }
-        oput_cstr_OFile (of, "<li>");
-        st->list_item_open = true;
-      }
-      else if (skip_cstr_XFile (xf, "textiff")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<i>iff</i>");
-      }
-      else if (skip_cstr_XFile (xf, "newcommand{\\")) {
-        good = parse_newcommand (xf, &st->macro_map);
-      }
-      else if (skip_cstr_XFile (xf, "quicksec{")) {
-        close_paragraph (st);
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<b>");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, ".</b>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "expten{")) {
-        open_paragraph (st);
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          oput_cstr_OFile (of, "&times;10<sup>");
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</sup>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "textit{")) {
-        open_paragraph (st);
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          oput_cstr_OFile (of, " <i>");
-          htbody (of, olay, st);
-          //escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</i>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "textbf{")) {
-        open_paragraph (st);
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          oput_cstr_OFile (of, " <b>");
-          htbody (of, olay, st);
-          //escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</b>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "texttt{")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, " <span class=\"texttt\">");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</span>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "underline{")) {
-        open_paragraph (st);
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          oput_cstr_OFile (of, " <span class=\"underline\">");
-          htbody (of, olay, st);
-          //escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</span>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "ilcode{")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<code>");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, 0);
-          oput_cstr_OFile (of, "</code>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "ilflag{")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<b>");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</b>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "ilfile{")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<i>");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</i>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "ilsym{")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<b>");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</b>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "illit{")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<i>");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</i>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "ilname{")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<b>");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</b>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "ilkey{")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<b>");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</b>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "ttvbl{")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, " <span class=\"ttvbl\">");
-        DoLegitLine( "no closing brace" )
-          getmatchd_olay_XFile (olay, xf, "{", "}");
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</span>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "begin{code}\n"))
-      {
-        Bool cram = false;
-        if (st->inparagraph || st->cram) {
-          cram = true;
-        }
-        close_paragraph (st);
-        oput_cstr_OFile (of, "\n<pre");
-        if (cram)
-          oput_cstr_OFile (of, " class=\"cram\"");
-        oput_cstr_OFile (of, "><code>");
-
-        DoLegitLine( "Need \\end{code} for \\begin{code}!" )
-          getlined_olay_XFile (olay, xf, "\n\\end{code}");
-        if (good) {
-          escape_for_html (of, olay, 0);
-          oput_cstr_OFile (of, "</code></pre>");
-        }
-        st->cram = true;
-      }
-      else if (skip_cstr_XFile (xf, "codeinputlisting{"))
-      {
-        Bool cram = false;
-        XFileB xfileb[] = default;
-        if (st->inparagraph || st->cram) {
-          cram = true;
-        }
-        close_paragraph (st);
-        oput_cstr_OFile (of, "\n<pre");
-        if (cram)
-          oput_cstr_OFile (of, " class=\"cram\"");
-        oput_cstr_OFile (of, "><code>");
-
-        DoLegitLine( "no closing brace" )
-          getlined_olay_XFile (olay, xf, "}");
-
-        DoLegit( "cannot open listing" )
-        {
-          const char* filename = ccstr_of_XFile (olay);
-          good = open_FileB (&xfileb->fb, st->pathname, filename);
-        }
-        if (good)
-          escape_for_html (of, &xfileb->xf, 0);
-        oput_cstr_OFile (of, "</code></pre>");
-        lose_XFileB (xfileb);
-      }
-      else if (skip_cstr_XFile (xf, "begin{flushleft}")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<div class=\"ljust\">");
-        DoLegitLine( "No end to flushleft!" )
-          getlined_olay_XFile (olay, xf, "\\end{flushleft}");
-        if (good) {
-          htbody (of, olay, st);
-          oput_cstr_OFile (of, "</div>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "begin{center}")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<div class=\"cjust\">");
-        DoLegitLine( "No end to center!" )
-          getlined_olay_XFile (olay, xf, "\\end{center}");
-        if (good) {
-          htbody (of, olay, st);
-          oput_cstr_OFile (of, "</div>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "begin{flushright}")) {
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<div class=\"rjust\">");
-        DoLegitLine( "No end to flushright!" )
-          getlined_olay_XFile (olay, xf, "\\end{flushright}");
-        if (good) {
-          htbody (of, olay, st);
-          oput_cstr_OFile (of, "</div>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "begin{tabular}{")) {
-        const char* cols = 0;
-        const bool inparagraph = st->inparagraph;
-        DoLegitLine( "Need \\end{tabular} for \\begin{tabular}!" )
-          getlined_olay_XFile (olay, xf, "\n\\end{tabular}");
-
-        DoLegitLineP( cols, "Need column spec for tabular!" )
-          getlined_XFile (olay, "}");
-
-        DoLegit( 0 ) {
-          uint i;
-          XFile line_olay[1];
-
-          oput_cstr_OFile (of, "\n<table>");
-
-          while (getlined_olay_XFile (line_olay, olay, "\\\\")) {
-            XFile cell_olay[1];
-            i = 0;
-            skipds_XFile (line_olay, 0);
-            if (skip_cstr_XFile (line_olay, "\\hline"))
-              oput_cstr_OFile (of, "\n<tr class=\"hline\">");
-            else
-              oput_cstr_OFile (of, "\n<tr>");
-
-            while (getlined_olay_XFile (cell_olay, line_olay, "&")) {
-              bool lline = false;
-              bool rline = false;
-              Sign align = -1;
-
-              skipds_XFile (cell_olay, 0);
-
-              if (cols[i]=='|') { ++i; lline = true; }
-              if      (cols[i]=='l') { ++i; align = -1; }
-              else if (cols[i]=='c') { ++i; align =  0; }
-              else if (cols[i]=='r') { ++i; align =  1; }
-              if (cols[i]=='|') { ++i; rline = true; }
-
-              if (!lline && !rline && align < 0) {
-                oput_cstr_OFile (of, "\n<td>");
-              }
-              else {
-                const char* pfx = "";
-                oput_cstr_OFile (of, "\n<td class=\"");
-                if (lline) {
-                  oput_cstr_OFile (of, pfx);
-                  pfx = " ";
-                  oput_cstr_OFile (of, "lline");
-                }
-
-                if (align == 0) {
-                  oput_cstr_OFile (of, pfx);
-                  pfx = " ";
-                  oput_cstr_OFile (of, "cjust");
-                }
-
-                if (align > 0) {
-                  oput_cstr_OFile (of, pfx);
-                  pfx = " ";
-                  oput_cstr_OFile (of, "rjust");
-                }
-
-                if (rline) {
-                  oput_cstr_OFile (of, pfx);
-                  pfx = " ";
-                  oput_cstr_OFile (of, "rline");
-                }
-                oput_cstr_OFile (of, "\">");
-              }
-              st->inparagraph = true;
-              htbody (of, cell_olay, st);
-              oput_cstr_OFile (of, "</td>");
-            }
-            oput_cstr_OFile (of, "\n</tr>");
-          }
-          oput_cstr_OFile (of, "\n</table>");
-          st->inparagraph = inparagraph;
-        }
-      }
-      else if (skip_cstr_XFile (xf, "tableofcontents")) {
-        st->show_toc = true;
-        st->toc_pos = st->body_ofile->off;
-      }
-      else if (skip_cstr_XFile (xf, "section{")) {
-        close_paragraph (st);
-        if (st->nsubsections > 0)
-          oput_cstr_OFile (st->toc_ofile, "</li></ol>");
-        ++ st->nsections;
-        st->nsubsections = 0;
-        good = next_section (of, xf, st);
-      }
-      else if (skip_cstr_XFile (xf, "subsection{")) {
-        close_paragraph (st);
-        ++ st->nsubsections;
-        good = next_section (of, xf, st);
-      }
-      else if (skip_cstr_XFile (xf, "label{")) {
-        DoLegitLine( "no closing brace for \\label" )
-          getlined_olay_XFile (olay, xf, "}");
-        if (good) {
-          oput_uint_OFile (of, st->nsections);
-          oput_cstr_OFile (of, "<a name=\"");
-          oput_cstr_OFile (of, ccstr_of_XFile (olay));
-          oput_cstr_OFile (of, "\"></a>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "href{")) {
-        if (pending_newline)
-          oput_char_OFile (of, '\n');
-        good = insert_href (st, xf, false);
-      }
-      else if (skip_cstr_XFile (xf, "texthref{")) {
-        if (pending_newline)
-          oput_char_OFile (of, '\n');
-        good = insert_href (st, xf, true);
-      }
-      else if (skip_cstr_XFile (xf, "url{")) {
-        if (pending_newline)
-          oput_char_OFile (of, '\n');
-        open_paragraph (st);
-        DoLegitLine( "no closing brace" )
-          getlined_olay_XFile (olay, xf, "}");
-        if (good) {
-          XFile olay2[1];
-          *olay2 = *olay;
-          oput_cstr_OFile (of, "<a href='");
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "'>");
-          escape_for_html (of, olay2, &st->macro_map);
-          oput_cstr_OFile (of, "</a>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "caturl{")) {
-        if (pending_newline)
-          oput_char_OFile (of, '\n');
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<a href=\"");
-        DoLegitLine( "no closing/open for caturl" )
-          getlined_olay_XFile (olay, xf, "}{");
-
-        DoLegit( "no closing brace" )
-        {
-          escape_for_html (of, olay, &st->macro_map);
-          good = getlined_olay_XFile (olay, xf, "}");
-        }
-        if (good) {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "\">");
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "</a>");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "includegraphics{")) {
-        if (pending_newline)
-          oput_char_OFile (of, '\n');
-        open_paragraph (st);
-        oput_cstr_OFile (of, "<img src=\"");
-        DoLegitLine( "no closing for includegraphics" )
-          getlined_olay_XFile (olay, xf, "}");
-
-        DoLegit( 0 )
-        {
-          escape_for_html (of, olay, &st->macro_map);
-          oput_cstr_OFile (of, "\" />");
-        }
-      }
-      else if (skip_cstr_XFile (xf, "input{")) {
-        XFileB xfb[] = default;
-        AlphaTab filename[] = default;
-        DoLegitLine( "no closing brace" )
-          getlined_olay_XFile (olay, xf, "}");
-
-        DoLegit( "Cannot open file!" )
-        {
-          cat_cstr_AlphaTab (filename, ccstr_of_XFile (olay));
-          cat_cstr_AlphaTab (filename, ".tex");
-          good = open_FileB (&xfb->fb, st->pathname, ccstr_of_AlphaTab (filename));
-          if (!good) {
-            for (uint i = 0; i < st->search_paths.sz && !good; ++i) {
-              good = open_FileB (&xfb->fb,
-                                 ccstr_of_AlphaTab (&st->search_paths.s[i]),
-                                 ccstr_of_AlphaTab (filename));
-            }
-          }
-        }
-        if (good) {
-          const char* tmp = st->pathname;
-          st->pathname = ccstr_of_AlphaTab (&xfb->fb.pathname);
-          htbody (of, &xfb->xf, st);
-          st->pathname = tmp;
-        }
-        else {
-          DBog0( st->pathname );
-          DBog0( ccstr_of_AlphaTab (filename) );
-        }
-        lose_XFileB (xfb);
-        lose_AlphaTab (filename);
-      }
-      else if (skip_cstr_XFile (xf, "end{document}"))
-      {
-        close_paragraph (st);
-        st->end_document = true;
-        break;
-      }
-      else {
-        handle_macro (of, xf, &st->macro_map);
-      }
-    }
+/** Write the -stats JSON to {filename}, or to stderr when it is "-".
+ * It holds the objects in {docs} and the output counts of {sink}.
+ **/
+static
+  bool
+write_stats_file (const char* filename, OFile* docs, const OSink* sink)
+{
+  OFileB ofb[] = default;
+  OFile* of = stderr_OFile ();
+  bool good = true;
+  if (!eq_cstr ("-", filename)) {
+    good = open_FileB (&ofb->fb, 0, filename);
+    of = &ofb->of;
   }
-
-  st->allgood = st->allgood && good;
+  if (good) {
+    oput_cstr_OFile (of, "{\"documents\":[");
+    oputn_char_OFile (of, window2_OFile (docs, 0, docs->off).s,
+                      docs->off);
+    oput_cstr_OFile (of, "],\"output\":");
+    oput_stats_OSink (of, sink);
+    oput_cstr_OFile (of, "}\n");
+    flush_OFile (of);
+  }
+  else {
+    DBog1( "cannot write stats: %s", filename );
+  }
+  lose_OFileB (ofb);
   return good;
 }
 
@@ -1193,49 +6510,132 @@ main (int argc, char** argv)
     (init_sysCx (&argc, &argv),
      1);
   DeclLegit( good );
-  XFileB xfb[] = default;
+  InFile in[1];
   OFileB ofb[] = default;
   XFile* xf = stdin_XFile ();
-  OFile* of = stdout_OFile ();
+  OSink sink[1];
+  OSink stats[1];
+  int fd = -1;
+  const char* stats_path = 0;
+  DocStats docstats[1];
+  OFile stats_json[] = default;
+  const char* manifest = 0;
+  const char* preamble = 0;
+  const char* input_path = 0;
+  const char* preamble_path = 0;
+  const char* output = 0;
+  const char* depfile = 0;
+  bool write_changes = false;
+  bool watch = false;
+  bool stream = false;
+  OFile out_ofile[] = default;
+  uint nworkers = 1;
   HtmlState st[1];
+  Ir ir[1];
 
-  init_HtmlState (st, of);
+  init_InFile (in);
+  init_fd_OSink (sink, STDOUT_FILENO);
+  init_count_OSink (stats);
+  init_HtmlState (st, sink);
 
   while (good && argi < argc)
   {
     const char* arg = argv[argi++];
     if (eq_cstr ("-x", arg)) {
+      input_path = argv[argi];
       DoLegitLine( "open file for reading" )
-        open_FileB (&xfb->fb, 0, argv[argi++]);
+        open_InFile (in, 0, argv[argi++]);
       if (good) {
-        xf = &xfb->xf;
+        xf = in->xf;
       }
     }
     else if (eq_cstr ("-o", arg)) {
-      DoLegitLine( "open file for writing" )
-        open_FileB (&ofb->fb, 0, argv[argi++]);
-      if (good) {
-        st->ofile = &ofb->of;
+      if (argi == argc) {
+        failout_sysCx ("no argument given for -o");
+      }
+      output = argv[argi++];
+    }
+    else if (eq_cstr ("-count", arg)) {
+      output = 0;
+      init_count_OSink (sink);
+    }
+    else if (eq_cstr ("-MD", arg)) {
+      if (argi == argc) {
+        failout_sysCx ("no argument given for -MD");
+      }
+      depfile = argv[argi++];
+    }
+    else if (eq_cstr ("-write-if-changed", arg)) {
+      write_changes = true;
+    }
+    else if (eq_cstr ("-stats", arg)) {
+      if (argi == argc) {
+        failout_sysCx ("no argument given for -stats");
+      }
+      stats_path = argv[argi++];
+      if (!Tex2WebStats) {
+        failout_sysCx ("-stats is not built in");
+      }
+    }
+    else if (eq_cstr ("-emit-ir", arg)) {
+      if (argi == argc) {
+        failout_sysCx ("no argument given for -emit-ir");
+      }
+      if (!eq_cstr ("json", argv[argi++])) {
+        failout_sysCx ("-emit-ir only writes json");
+      }
+      if (!st->ir) {
+        init_Ir (ir);
+        st->ir = ir;
+      }
+    }
+    else if (eq_cstr ("-batch", arg)) {
+      if (argi == argc) {
+        failout_sysCx ("no argument given for -batch");
+      }
+      manifest = argv[argi++];
+    }
+    else if (eq_cstr ("-watch", arg)) {
+      watch = true;
+    }
+    else if (eq_cstr ("-stream", arg)) {
+      stream = true;
+    }
+    else if (eq_cstr ("-j", arg)) {
+      int n = 0;
+      if (argi == argc) {
+        failout_sysCx ("no argument given for -j");
       }
+      n = atoi (argv[argi++]);
+      if (n < 1) {
+        failout_sysCx ("-j needs a positive number of threads");
+      }
+      nworkers = (uint) n;
     }
     else if (eq_cstr ("-o-css", arg)) {
+      OFile* of;
       if (argi == argc) {
         failout_sysCx ("no argument given for -o-css");
       }
       arg = argv[argi++];
+      of = stdout_OFile ();
       if (!eq_cstr ("-", arg)) {
         DoLegitLine( "open file for writing" )
           open_FileB (&ofb->fb, 0, arg);
         if (good)
-          st->ofile = &ofb->of;
+          of = &ofb->of;
       }
       if (good) {
-        css_html (st);
+        css_html (of);
       }
 
+      if (st->ir)
+        lose_Ir (ir);
       lose_HtmlState (st);
-      lose_XFileB (xfb);
+      lose_InFile (in);
       lose_OFileB (ofb);
+      if (fd >= 0)
+        close (fd);
       lose_sysCx ();
       return (good ? 0 : 1);
     }
@@ -1257,11 +6657,34 @@ main (int argc, char** argv)
         ++ argi;
       }
     }
+    else if (eq_cstr ("-dump-preamble", arg)) {
+      if (argi == argc) {
+        failout_sysCx ("no argument given for -dump-preamble");
+      }
+      preamble = argv[argi++];
+    }
+    else if (eq_cstr ("-preamble", arg)) {
+      if (argi == argc) {
+        failout_sysCx ("no argument given for -preamble");
+      }
+      preamble_path = argv[argi];
+      DoLegitLine( "load preamble snapshot" )
+        load_preamble (st, argv[argi++]);
+    }
+    else if (eq_cstr ("-cache-dir", arg)) {
+      if (argi == argc) {
+        failout_sysCx ("no argument given for -cache-dir");
+      }
+      st->cache_dir = argv[argi++];
+      if (0 != mkdir (st->cache_dir, 0777) && errno != EEXIST) {
+        failout_sysCx ("cannot create -cache-dir");
+      }
+    }
     else if (eq_cstr ("-def", arg)) {
       if (argi+1 >= argc) {
         failout_sysCx ("Need 2 arguments for -def");
       }
-      add_newcommand (&st->macro_map, argv[argi], argv[argi+1]);
+      add_newcommand (st, argv[argi], 0, argv[argi+1]);
       argi += 2;
     }
     else {
@@ -1271,24 +6694,152 @@ main (int argc, char** argv)
   if (!good)
     return 1;
 
-  st->pathname = ccstr_of_AlphaTab (&xfb->fb.pathname);
-  DoLegitLine( "Failed to parse heading" )
-    hthead (st, xf);
-  DoLegitLine( "Failed to parse body" )
-    htbody (st->body_ofile, xf, st);
-  DoLegit( 0 ) {
-    foot_html (st);
+  if (manifest && (depfile || write_changes)) {
+    failout_sysCx ("-MD and -write-if-changed do not work with -batch");
   }
-  if (!st->end_document) {
+  if (watch && !manifest) {
+    failout_sysCx ("-watch needs a -batch manifest of documents");
+  }
+  if (!manifest) {
+    /* Render the sections of the one document on several threads.*/
+    st->nthreads = nworkers;
+  }
+  if (stream && (input_path || manifest || st->ir || st->cache_dir ||
+                 stats_path)) {
+    failout_sysCx ("-stream only reads stdin, without caches, IR or stats");
+  }
+  if (depfile && !output) {
+    failout_sysCx ("-MD needs an -o file to name as the target");
+  }
+  if (output && write_changes) {
+    /* Compare the whole output with the file before writing it.*/
+    init_mem_OSink (sink, out_ofile);
+  }
+  else if (output) {
+    fd = open_output_fd (0, output);
+    DoLegitLine( "open file for writing" )
+      (fd >= 0);
+    if (!good)
+      return 1;
+    init_fd_OSink (sink, fd);
+  }
+
+  if (preamble) {
+    InFile pre[1];
+    init_InFile (pre);
+    DoLegitLine( "open preamble for reading" )
+      open_InFile (pre, 0, preamble);
+    DoLegitLine( "Failed to parse preamble" )
+      htpreamble (st, pre->xf);
+    DoLegitLine( "write preamble snapshot" )
+      dump_preamble (st);
+    if (good && output && write_changes) {
+      DoLegitLine( "write preamble snapshot" )
+        write_if_changed (output, out_ofile, stats);
+    }
+    lose_OFile (out_ofile);
+    lose_InFile (pre);
+    if (st->ir)
+      lose_Ir (ir);
+    lose_HtmlState (st);
+    lose_InFile (in);
+    lose_OFileB (ofb);
+    if (fd >= 0)
+      close (fd);
+    lose_sysCx ();
+    return good ? 0 : 1;
+  }
+
+  if (manifest) {
+    if (watch)
+      good = watch_htdocuments (st, manifest, stats);
+    else
+      good = batch_htdocuments (st, manifest, nworkers, stats,
+                                stats_path ? stats_json : 0);
+    if (stats_path && !write_stats_file (stats_path, stats_json, stats))
+      good = false;
+    lose_OFile (stats_json);
+    if (st->ir)
+      lose_Ir (ir);
+    lose_HtmlState (st);
+    lose_InFile (in);
+    lose_OFileB (ofb);
+    if (fd >= 0)
+      close (fd);
+    lose_sysCx ();
+    return good ? 0 : 1;
+  }
+
+  st->pathname = ccstr_of_AlphaTab (&in->pathname);
+  if (st->ir)
+    ir->name = (input_path ? input_path : "-");
+  if (stats_path) {
+    init_DocStats (docstats, ArraySz(htcmds));
+    st->stats = docstats;
+  }
+  if (stream) {
+    /* Convert each part of stdin as soon as it can be.*/
+    HtPush push[1];
+    char buf[1 << 16];
+    init_HtPush (push, st);
+    for (;;) {
+      const ssize_t n = read (STDIN_FILENO, buf, sizeof (buf));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        htbog (st, "Cannot read stdin", 0);
+        st->allgood = false;
+      }
+      if (n <= 0)
+        break;
+      push_HtPush (push, buf, (zuint) n);
+    }
+    good = close_HtPush (push);
+    lose_HtPush (push);
+  }
+  else {
+    good = htdocument (st, xf);
+  }
+  if (stats_path) {
+    oput_json_DocStats (stats_json, docstats, input_path ? input_path : "-");
+    st->stats = 0;
+    lose_DocStats (docstats);
+  }
+  if (output && write_changes &&
+      !write_if_changed (output, out_ofile, stats)) {
+    DBog1( "cannot write output: %s", output );
     good = false;
   }
-  good = good && st->allgood;
+  if (depfile) {
+    OFile dep_ofile[] = default;
+    const char* srcs[2];
+    uint nsrcs = 0;
+    if (input_path)
+      srcs[nsrcs++] = input_path;
+    if (preamble_path)
+      srcs[nsrcs++] = preamble_path;
+    oput_depfile (dep_ofile, st, output, srcs, nsrcs);
+    if (!write_if_changed (depfile, dep_ofile, stats)) {
+      DBog1( "cannot write depfile: %s", depfile );
+      good = false;
+    }
+    lose_OFile (dep_ofile);
+  }
+  lose_OFile (out_ofile);
+  if (stats_path) {
+    add_stats_OSink (stats, sink);
+    if (!write_stats_file (stats_path, stats_json, stats))
+      good = false;
+    lose_OFile (stats_json);
+  }
 
+  if (st->ir)
+    lose_Ir (ir);
   lose_HtmlState (st);
-  lose_XFileB (xfb);
+  lose_InFile (in);
   lose_OFileB (ofb);
+  if (fd >= 0)
+    close (fd);
   lose_sysCx ();
-  good = 1;
   return good ? 0 : 1;
 }
-
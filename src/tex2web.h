@@ -0,0 +1,67 @@
+/**
+ * Convert LaTeX text to HTML in memory.
+ *
+ * A Tex2Web holds the options of conversions.
+ * Once its options are set, it can be shared by any number of threads,
+ * since each call to convert_Tex2Web() works in its own state.
+ * A document that arrives in pieces, as from a socket or pipe,
+ * can be given to a Tex2WebStream, which writes HTML as it goes.
+ * Nothing is kept in process-global variables.
+ **/
+#ifndef TEX2WEB_H_
+#define TEX2WEB_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define Tex2WebApi  __attribute__ ((visibility ("default")))
+#else
+#define Tex2WebApi
+#endif
+
+typedef struct Tex2Web Tex2Web;
+typedef struct Tex2WebStream Tex2WebStream;
+
+/** Give the text of the file {name} that a document asks for
+ * with \input (with ".tex" added) or \codeinputlisting.
+ * Return NUL-terminated text from malloc(), which is freed after use,
+ * or null when there is no such file.
+ * It may be called from several threads at once.
+ **/
+typedef char* (*Tex2WebIncludeFn) (void* arg, const char* name);
+
+/** Take the next {sz} bytes of HTML from a Tex2WebStream.
+ * Return nonzero when they were written.
+ **/
+typedef int (*Tex2WebWriteFn) (void* arg, const char* html, size_t sz);
+
+Tex2WebApi Tex2Web*
+new_Tex2Web ();
+Tex2WebApi void
+free_Tex2Web (Tex2Web* t);
+Tex2WebApi void
+def_Tex2Web (Tex2Web* t, const char* name, const char* value);
+Tex2WebApi void
+css_Tex2Web (Tex2Web* t, const char* path);
+Tex2WebApi void
+search_path_Tex2Web (Tex2Web* t, const char* dir);
+Tex2WebApi void
+include_Tex2Web (Tex2Web* t, Tex2WebIncludeFn fn, void* arg);
+Tex2WebApi int
+convert_Tex2Web (const Tex2Web* t, const char* text, size_t sz,
+                 char** ret_html, size_t* ret_html_sz, char** ret_log);
+Tex2WebApi Tex2WebStream*
+open_Tex2WebStream (const Tex2Web* t, Tex2WebWriteFn fn, void* arg);
+Tex2WebApi int
+push_Tex2WebStream (Tex2WebStream* stream, const char* text, size_t sz);
+Tex2WebApi int
+close_Tex2WebStream (Tex2WebStream* stream, char** ret_log);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -7,8 +7,12 @@ expect=${exepath}/expect
 css='-css style.css'
 
 $tex2web -x "$example/hello.tex" -o "$expect/hello.html" $css
+$tex2web -x "$example/input.tex" -o "$expect/input.html" $css
+$tex2web -x "$example/listing.tex" -o "$expect/listing.html" $css
 $tex2web -x "$example/macro.tex" -o "$expect/macro.html" -def pathname ../my/path $css
 $tex2web -x "$example/table.tex" -o "$expect/table.html" $css
 $tex2web -x "$example/toc.tex" -o "$expect/toc.html" $css
+$tex2web -batch "$exepath/batch.txt" $css > "$expect/batch.html"
+(cd "$exepath/.." && bin/tex2web -x example/hello.tex -o test/expect/hello.json -emit-ir json)
 $tex2web -o-css "$expect/style.css"
 
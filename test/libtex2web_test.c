@@ -0,0 +1,88 @@
+/**
+ * Convert a document through the library API of tex2web
+ * and check the HTML against what the tex2web binary gives.
+ *
+ * Usage example:
+ *   libtex2web_test example/hello.tex test/expect/hello.html
+ * converts with "-css style.css", as test/gen.sh does.
+ **/
+
+#include "tex2web.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Read the whole file at {path} into memory from malloc().**/
+static
+  char*
+slurp (const char* path, size_t* ret_sz)
+{
+  FILE* f = fopen (path, "rb");
+  char* s = 0;
+  size_t sz = 0;
+  size_t n;
+  if (!f)
+    return 0;
+  do {
+    char* t = (char*) realloc (s, sz + 4096 + 1);
+    if (!t) {
+      free (s);
+      fclose (f);
+      return 0;
+    }
+    s = t;
+    n = fread (&s[sz], 1, 4096, f);
+    sz += n;
+  } while (n > 0);
+  fclose (f);
+  s[sz] = '\0';
+  *ret_sz = sz;
+  return s;
+}
+
+  int
+main (int argc, char** argv)
+{
+  Tex2Web* t;
+  char* text;
+  char* expect;
+  char* html = 0;
+  char* log = 0;
+  size_t text_sz = 0;
+  size_t expect_sz = 0;
+  size_t html_sz = 0;
+  int good;
+
+  if (argc != 3) {
+    fputs ("usage: libtex2web_test IN.tex EXPECT.html\n", stderr);
+    return 1;
+  }
+  text = slurp (argv[1], &text_sz);
+  expect = slurp (argv[2], &expect_sz);
+  if (!text || !expect) {
+    fputs ("cannot read the input or expected output\n", stderr);
+    return 1;
+  }
+
+  t = new_Tex2Web ();
+  css_Tex2Web (t, "style.css");
+  good = convert_Tex2Web (t, text, text_sz, &html, &html_sz, &log);
+  if (!good)
+    fputs ("convert_Tex2Web() failed\n", stderr);
+  if (log) {
+    fputs (log, stderr);
+    good = 0;
+  }
+  if (html_sz != expect_sz || 0 != memcmp (html, expect, html_sz)) {
+    fputs ("HTML differs from the expected output\n", stderr);
+    good = 0;
+  }
+
+  free (log);
+  free (html);
+  free_Tex2Web (t);
+  free (expect);
+  free (text);
+  return good ? 0 : 1;
+}